@@ -29,11 +29,105 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#if defined (_WIN32)
+# include <windows.h>
+#else
+# include <sys/types.h>
+# include <sys/mman.h>
+# include <unistd.h>
+#endif	/* _WIN32 */
 
 #include "my_bitstring.h"
 #define POOL_NALLOC_PEEK
 #include "m_pool.h"
 
+#if !defined (_WIN32)
+# if !defined (MAP_ANON)
+#  define MAP_ANON		MAP_ANONYMOUS
+# endif
+# if !defined (MAP_NORESERVE)
+#  define MAP_NORESERVE		0
+# endif
+#endif	/* !_WIN32 */
+
+static	int mpool_lazy_init(struct mpool *);
+static	int mpool_commit(struct mpool *,int);
+static	void mpool_decommit(struct mpool *,int);
+
+/*
+ * Address space reservation primitives.  Reserved memory is not
+ * accessible (and not charged to the process) until committed.
+ */
+static void *
+vm_reserve(len)
+	size_t	len;
+{
+#if defined (_WIN32)
+	return (VirtualAlloc(NULL, len, MEM_RESERVE, PAGE_NOACCESS));
+#else
+	void *p;
+
+	p = mmap(NULL, len, PROT_NONE, MAP_PRIVATE | MAP_ANON | MAP_NORESERVE,
+	    -1, 0);
+	return (p == MAP_FAILED ? NULL : p);
+#endif
+}
+
+static int
+vm_commit(addr, len)
+	void	*addr;
+	size_t	len;
+{
+#if defined (_WIN32)
+	return (VirtualAlloc(addr, len, MEM_COMMIT, PAGE_READWRITE) == NULL ?
+	    -1 : 0);
+#else
+	return (mprotect(addr, len, PROT_READ | PROT_WRITE));
+#endif
+}
+
+static void
+vm_decommit(addr, len)
+	void	*addr;
+	size_t	len;
+{
+#if defined (_WIN32)
+	VirtualFree(addr, len, MEM_DECOMMIT);
+#else
+	madvise(addr, len, MADV_DONTNEED);
+	mprotect(addr, len, PROT_NONE);
+#endif
+	return;
+}
+
+static void
+vm_release(addr, len)
+	void	*addr;
+	size_t	len;
+{
+#if defined (_WIN32)
+	VirtualFree(addr, 0, MEM_RELEASE);
+#else
+	munmap(addr, len);
+#endif
+	return;
+}
+
+static size_t
+vm_pagesize()
+{
+#if defined (_WIN32)
+	SYSTEM_INFO si;
+
+	GetSystemInfo(&si);
+	return (si.dwPageSize);
+#else
+	return (sysconf(_SC_PAGESIZE));
+#endif
+}
+
 int
 mpool_init(mp, label, nobjs, objsiz)
 	struct	mpool **mp;
@@ -55,6 +149,16 @@ mpool_init(mp, label, nobjs, objsiz)
 	m0->mp_rsiz = objsiz;
 #endif
 	m0->mp_label = label;
+#if !defined (MPOOL_NO_LAZY)
+	if ((size_t)m0->mp_nobjs * m0->mp_rsiz >= MPOOL_LAZY_MIN) {
+		if (mpool_lazy_init(m0) < 0) {
+			MPOOL_LOG(("mpool_init(%s): cannot reserve %d bytes\n",
+			    label, m0->mp_nobjs * m0->mp_rsiz));
+			mpool_free(m0);
+			return (-1);
+		}
+	} else
+#endif	/* !MPOOL_NO_LAZY */
 	if ((m0->mp_base = malloc(m0->mp_nobjs * m0->mp_rsiz)) == NULL) {
 		MPOOL_LOG(("mpool_init(%s): out of memory for %d bytes\n",
 		    label, m0->mp_nobjs * m0->mp_rsiz));
@@ -66,27 +170,375 @@ mpool_init(mp, label, nobjs, objsiz)
 	if ((m0->mp_bmap = (u_char *)bit_alloc(m0->mp_bmapsz)) == NULL) {
 		MPOOL_LOG(("mpool_init(%s): out of memory for bitmap\n",
 		    label));
-		free(m0->mp_base);
-		free(m0);
+		mpool_free(m0);
 		return (-1);
 	}
 	*mp = m0;
 	return (0);
 }
 
+/* Regions start this far into memory given to mpool_init_mem() */
+#define MPOOL_MEMOFF(nobjs)	((bitstr_size(BMAP_SIZE(nobjs)) + 63) & ~63)
+
+size_t
+mpool_memsz(nobjs, objsiz)
+	int	nobjs;
+	size_t	objsiz;
+{
+
+#if defined (MPOOL_ALIGNMENT)
+	objsiz = (objsiz + (sizeof(long) - 1)) & ~(sizeof(long) - 1);
+#endif
+	return (MPOOL_MEMOFF(nobjs) + (size_t)nobjs * objsiz);
+}
+
+/*
+ * Like mpool_init() but in the `len' bytes at `mem', which must be at
+ * least mpool_memsz() bytes.  The bitmap is cleared.
+ */
+int
+mpool_init_mem(mp, label, nobjs, objsiz, mem, len)
+	struct	mpool **mp;
+	char	*label;
+	int	nobjs;
+	size_t	objsiz;
+	void	*mem;
+	size_t	len;
+{
+	struct mpool *m0;
+
+	if (len < mpool_memsz(nobjs, objsiz)) {
+		MPOOL_LOG(("mpool_init_mem(%s): %lu bytes are too few\n",
+		    label, (unsigned long)len));
+		return (-1);
+	}
+	if ((m0 = malloc(sizeof(struct mpool))) == NULL) {
+		MPOOL_LOG(("mpool_init_mem(%s): out of memory\n", label));
+		return (-1);
+	}
+	memset(m0, 0, sizeof(struct mpool));
+	m0->mp_nobjs = nobjs;
+#if defined (MPOOL_ALIGNMENT)
+	m0->mp_rsiz = (objsiz + (sizeof(long) - 1)) & ~(sizeof(long) - 1);
+#else
+	m0->mp_rsiz = objsiz;
+#endif
+	m0->mp_label = label;
+	m0->mp_flags = MPOOL_EXTMEM;
+	m0->mp_bmapsz = BMAP_SIZE(m0->mp_nobjs);
+	m0->mp_maxbytes = m0->mp_bmapsz >> 3;
+	m0->mp_bmap = mem;
+	m0->mp_base = (u_char *)mem + MPOOL_MEMOFF(nobjs);
+	memset(m0->mp_bmap, 0, bitstr_size(m0->mp_bmapsz));
+	*mp = m0;
+	return (0);
+}
+
 void
 mpool_free(mp)
 	struct	mpool *mp;
 {
 
-	if (mp->mp_base != NULL)
-		free(mp->mp_base);
+	if ((mp->mp_flags & MPOOL_EXTMEM) != 0) {
+		free(mp);
+		return;
+	}
+	if (mp->mp_base != NULL) {
+		if (mp->mp_mapsz != 0)
+			vm_release(mp->mp_base, mp->mp_mapsz);
+		else
+			free(mp->mp_base);
+	}
 	if (mp->mp_bmap != NULL)
 		free(mp->mp_bmap);
+	if (mp->mp_rlive != NULL)
+		free(mp->mp_rlive);
+	if (mp->mp_ridle != NULL)
+		free(mp->mp_ridle);
+	if (mp->mp_rstate != NULL)
+		free(mp->mp_rstate);
+	if (mp->mp_idleq != NULL)
+		free(mp->mp_idleq);
 	free(mp);
 	return;
 }
 
+/*
+ * Reserve address space for the pool and set up the per run
+ * bookkeeping.  Nothing is committed until mpool_rget().
+ */
+static int
+mpool_lazy_init(mp)
+	struct	mpool *mp;
+{
+	size_t runsiz, len;
+
+	runsiz = vm_pagesize();
+	for (mp->mp_runshift = 0; ((size_t)1 << mp->mp_runshift) < runsiz ||
+	    ((size_t)1 << mp->mp_runshift) < MPOOL_RUNSIZ; ++mp->mp_runshift)
+		;
+	runsiz = (size_t)1 << mp->mp_runshift;
+	len = (size_t)mp->mp_nobjs * mp->mp_rsiz;
+	mp->mp_nruns = (len + runsiz - 1) >> mp->mp_runshift;
+	mp->mp_idlethr = MPOOL_IDLE_RECLAIMS;
+	mp->mp_rlive = calloc(mp->mp_nruns, sizeof(int));
+	mp->mp_ridle = calloc(mp->mp_nruns, sizeof(int));
+	mp->mp_rstate = calloc(mp->mp_nruns, sizeof(u_char));
+	mp->mp_idleq = calloc(mp->mp_nruns, sizeof(int));
+	if (mp->mp_rlive == NULL || mp->mp_ridle == NULL ||
+	    mp->mp_rstate == NULL || mp->mp_idleq == NULL)
+		return (-1);
+	mp->mp_mapsz = (size_t)mp->mp_nruns << mp->mp_runshift;
+	if ((mp->mp_base = vm_reserve(mp->mp_mapsz)) == NULL) {
+		mp->mp_mapsz = 0;
+		return (-1);
+	}
+	return (0);
+}
+
+static int
+mpool_commit(mp, run)
+	struct	mpool *mp;
+	int	run;
+{
+
+	if (vm_commit(mp->mp_base + ((size_t)run << mp->mp_runshift),
+	    (size_t)1 << mp->mp_runshift) < 0) {
+		MPOOL_LOG(("mpool_commit(%s): cannot commit run %d\n",
+		    mp->mp_label, run));
+		return (-1);
+	}
+	mp->mp_rstate[run] |= MPOOL_RUN_COMMITTED;
+	++mp->mp_ncommit;
+	return (0);
+}
+
+static void
+mpool_decommit(mp, run)
+	struct	mpool *mp;
+	int	run;
+{
+
+	vm_decommit(mp->mp_base + ((size_t)run << mp->mp_runshift),
+	    (size_t)1 << mp->mp_runshift);
+	mp->mp_rstate[run] &= ~MPOOL_RUN_COMMITTED;
+	--mp->mp_ncommit;
+	++mp->mp_ndecommit;
+	return;
+}
+
+/* Drop a region from run `r', queueing the run if it becomes free */
+static void
+mpool_rdrop(mp, r)
+	struct	mpool *mp;
+	int	r;
+{
+
+	if (--mp->mp_rlive[r] != 0)
+		return;
+	mp->mp_ridle[r] = mp->mp_rreq;
+	if ((mp->mp_rstate[r] & MPOOL_RUN_QUEUED) == 0) {
+		mp->mp_rstate[r] |= MPOOL_RUN_QUEUED;
+		mp->mp_idleq[(mp->mp_iqhead + mp->mp_iqlen) %
+		    mp->mp_nruns] = r;
+		++mp->mp_iqlen;
+	}
+	return;
+}
+
+/*
+ * Called by mpool_get() before handing out region `b' of a lazy pool:
+ * account the region against every run it overlaps and commit the
+ * runs that are not backed yet.
+ */
+int
+mpool_rget(mp, b)
+	struct	mpool *mp;
+	int	b;
+{
+	size_t off;
+	int r, r0, r1;
+
+	off = (size_t)b * mp->mp_rsiz;
+	r0 = off >> mp->mp_runshift;
+	r1 = (off + mp->mp_rsiz - 1) >> mp->mp_runshift;
+	for (r = r0; r <= r1; r++) {
+		if (mp->mp_rlive[r]++ != 0 ||
+		    (mp->mp_rstate[r] & MPOOL_RUN_COMMITTED) != 0)
+			continue;
+		if (mpool_commit(mp, r) < 0) {
+			/* Runs already taken go idle, as if reclaimed */
+			--mp->mp_rlive[r];
+			while (--r >= r0)
+				mpool_rdrop(mp, r);
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+/*
+ * Called by mpool_reclaim() after region `b' is released.  Runs that
+ * become free are queued, and the head of the queue is examined so
+ * decommit work is spread over reclaims.
+ */
+void
+mpool_rput(mp, b)
+	struct	mpool *mp;
+	int	b;
+{
+	size_t off;
+	int r, r0, r1;
+
+	off = (size_t)b * mp->mp_rsiz;
+	r0 = off >> mp->mp_runshift;
+	r1 = (off + mp->mp_rsiz - 1) >> mp->mp_runshift;
+	for (r = r0; r <= r1; r++)
+		mpool_rdrop(mp, r);
+	mpool_trim(mp, 0);
+	return;
+}
+
+/*
+ * Give back runs on the idle FIFO that stayed free for at least
+ * mp_idlethr reclaims; with `force' every free run is given back
+ * regardless of its age.  Runs that were reused in the meantime are
+ * just dropped from the FIFO.
+ */
+void
+mpool_trim(mp, force)
+	struct	mpool *mp;
+	int	force;
+{
+	int n, r;
+
+	if (mp->mp_rlive == NULL)
+		return;
+	n = force ? mp->mp_iqlen : 2;
+	while (n-- > 0 && mp->mp_iqlen > 0) {
+		r = mp->mp_idleq[mp->mp_iqhead];
+		if (mp->mp_rlive[r] == 0 && !force && (unsigned)mp->mp_rreq -
+		    (unsigned)mp->mp_ridle[r] < (unsigned)mp->mp_idlethr)
+			break;
+		mp->mp_iqhead = (mp->mp_iqhead + 1) % mp->mp_nruns;
+		--mp->mp_iqlen;
+		mp->mp_rstate[r] &= ~MPOOL_RUN_QUEUED;
+		if (mp->mp_rlive[r] == 0 &&
+		    (mp->mp_rstate[r] & MPOOL_RUN_COMMITTED) != 0)
+			mpool_decommit(mp, r);
+	}
+	return;
+}
+
+/* Bitmap words scanned by mpool_iter_next() */
+#define MPOOL_WBITS		(8 * (int)sizeof(u_long))
+
+#if defined (__GNUC__)
+# define MPOOL_CTZ(w)		__builtin_ctzl(w)
+#else
+# define MPOOL_CTZ(w)		mpool_ctz(w)
+
+static int
+mpool_ctz(w)
+	u_long	w;
+{
+	int n;
+
+	for (n = 0; (w & 1) == 0; n++)
+		w >>= 1;
+	return (n);
+}
+#endif	/* __GNUC__ */
+
+/*
+ * Bitmap word `w', bit n of the pool in bit n % MPOOL_WBITS whatever
+ * the byte order.  The bitmap need not be a whole number of words.
+ */
+static u_long
+mpool_bmap_word(mp, w)
+	struct	mpool *mp;
+	int	w;
+{
+	u_char *p;
+	u_long v;
+	int i, n;
+
+	p = mp->mp_bmap + w * sizeof(u_long);
+	n = mp->mp_maxbytes - w * (int)sizeof(u_long);
+	v = 0;
+	if (n >= (int)sizeof(u_long)) {
+		/* Compilers turn this into one load */
+		for (i = 0; i < (int)sizeof(u_long); i++)
+			v |= (u_long)p[i] << (i * 8);
+	} else {
+		for (i = 0; i < n; i++)
+			v |= (u_long)p[i] << (i * 8);
+	}
+	return (v);
+}
+
+/*
+ * Iterate over the live regions numbered `from' up to `to' of `mp';
+ * `to' beyond the bitmap is cut down to its end.
+ */
+void
+mpool_iter_init(it, mp, from, to)
+	struct	mpool_iter *it;
+	struct	mpool *mp;
+	int	from;
+	int	to;
+{
+
+	it->mi_mp = mp;
+	it->mi_bit = from < 0 ? 0 : from;
+	it->mi_end = to > mp->mp_bmapsz ? mp->mp_bmapsz : to;
+	return;
+}
+
+/* Next live region of the range, NULL at its end */
+void *
+mpool_iter_next(it)
+	struct	mpool_iter *it;
+{
+	struct mpool *mp;
+	u_long w;
+	int b;
+
+	mp = it->mi_mp;
+	while ((b = it->mi_bit) < it->mi_end) {
+		w = mpool_bmap_word(mp, b / MPOOL_WBITS) >> (b % MPOOL_WBITS);
+		if (w == 0) {
+			/* Skip the rest of the word */
+			it->mi_bit = b - b % MPOOL_WBITS + MPOOL_WBITS;
+			continue;
+		}
+		b += MPOOL_CTZ(w);
+		if (b >= it->mi_end)
+			break;
+		it->mi_bit = b + 1;
+		return (mp->mp_base + (size_t)b * mp->mp_rsiz);
+	}
+	it->mi_bit = it->mi_end;
+	return (NULL);
+}
+
+int
+mpool_foreach(mp, cb, arg)
+	struct	mpool *mp;
+	int	(*cb)(void *,void *);
+	void	*arg;
+{
+	struct mpool_iter it;
+	void *p;
+	int error;
+
+	mpool_iter_init(&it, mp, 0, mp->mp_bmapsz);
+	while ((p = mpool_iter_next(&it)) != NULL)
+		if ((error = cb(p, arg)) != 0)
+			return (error);
+	return (0);
+}
+
 #if defined (MP_DEBUG)
 
 #if defined (UNIX)
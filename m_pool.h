@@ -36,6 +36,28 @@ typedef unsigned char	u_char;
 
 #include "my_bitstring.h"
 
+/*
+ * Large pools only reserve address space at mpool_init() time; pages
+ * are committed a run (MPOOL_RUNSIZ bytes) at a time when the first
+ * region inside the run is handed out, and runs that stay completely
+ * free for mp_idlethr reclaims are given back to the OS.  Pools smaller
+ * than MPOOL_LAZY_MIN bytes are allocated up front as before.
+ * In lazy pools the RRA pointer stays on the byte it last allocated
+ * from, so regions are packed into as few runs as possible.
+ */
+#if !defined (MPOOL_RUNSIZ)
+# define MPOOL_RUNSIZ		(64 * 1024)
+#endif
+#if !defined (MPOOL_LAZY_MIN)
+# define MPOOL_LAZY_MIN		(4 * MPOOL_RUNSIZ)
+#endif
+#if !defined (MPOOL_IDLE_RECLAIMS)
+# define MPOOL_IDLE_RECLAIMS	1024
+#endif
+
+#define MPOOL_RUN_COMMITTED	0x01	/* Run pages are accessible */
+#define MPOOL_RUN_QUEUED	0x02	/* Run is on the idle FIFO */
+
 struct mpool {
 	char	*mp_label;
 	int	mp_rsiz;	/* Object/region size */
@@ -49,12 +71,29 @@ struct mpool {
 	int	mp_rreq;	/* Number of successful reclaim requests */
 	int	mp_afail;	/* Allocation requests failure */
 	int	mp_rfail;	/* Reclaim requests failure */
+	unsigned long mp_nscan;	/* Bitmap bytes searched by mpool_get() */
+	int	mp_maxscan;	/* Most of them in one call */
 	/* Round Robin Allocation (RRA) scheme */
 	int	mp_rraptr;	/* Next byte to allocate from */
 	int	mp_maxbytes;	/* Number of bytes to hold bitmap */
 #if defined (POOL_NALLOC_PEEK)
 	int	mp_napeek;	/* Max # of allocations at any time */
 #endif
+	/* Lazy commit, mp_rlive is NULL for eagerly allocated pools */
+	size_t	mp_mapsz;	/* Bytes of address space reserved */
+	int	mp_runshift;	/* log2 of commit run size */
+	int	mp_nruns;	/* Number of commit runs */
+	int	*mp_rlive;	/* Allocated regions touching each run */
+	int	*mp_ridle;	/* mp_rreq value when run went idle */
+	u_char	*mp_rstate;	/* MPOOL_RUN_* flags of each run */
+	int	*mp_idleq;	/* FIFO of runs that went idle */
+	int	mp_iqhead;	/* Next run to examine for decommit */
+	int	mp_iqlen;	/* Runs on the idle FIFO */
+	int	mp_idlethr;	/* Reclaims a run stays free before decommit */
+	int	mp_ncommit;	/* Runs currently committed */
+	int	mp_ndecommit;	/* Number of runs given back to the OS */
+	int	mp_flags;
+#define MPOOL_EXTMEM		0x01	/* Memory is the caller's */
 };
 
 #if defined (POOL_NALLOC_PEEK)
@@ -86,12 +125,22 @@ struct mpool {
 #endif
 
 #define mpool_get(mp, maddr) do { \
-	int b; \
+	int b, __mp_scan; \
 	maddr = NULL; \
 	bit_effc((mp)->mp_bmap, (mp)->mp_bmapsz, &b, (mp)->mp_rraptr); \
-	++(mp)->mp_rraptr; \
+	__mp_scan = (b >= 0 ? _bit_byte(b) + 1 : (mp)->mp_maxbytes) - \
+	    (mp)->mp_rraptr; \
+	(mp)->mp_nscan += __mp_scan; \
+	if (__mp_scan > (mp)->mp_maxscan) \
+		(mp)->mp_maxscan = __mp_scan; \
+	if ((mp)->mp_rlive != NULL && b >= 0) \
+		(mp)->mp_rraptr = _bit_byte(b); \
+	else \
+		++(mp)->mp_rraptr; \
 	if ((mp)->mp_rraptr + 1 >= (mp)->mp_maxbytes) \
 		(mp)->mp_rraptr = 0; \
+	if (b >= 0 && (mp)->mp_rlive != NULL && mpool_rget(mp, b) < 0) \
+		b = -1; \
 	if (b >= 0) { \
 		maddr = (void *)((mp)->mp_base + (b * (mp)->mp_rsiz)); \
 		bit_set((mp)->mp_bmap, b); \
@@ -129,10 +178,39 @@ struct mpool {
 		REPOS_RRAPTR((mp)->mp_rraptr, b); \
 		--(mp)->mp_nalloc; \
 		++(mp)->mp_rreq; \
+		if ((mp)->mp_rlive != NULL) \
+			mpool_rput(mp, b); \
 	} \
 } while (0)
 
+/*
+ * Live regions are enumerated in address order from the bitmap, a
+ * word at a time.  An iterator covers regions [from, to) only, so
+ * several threads can walk one pool by taking ranges of it; the pool
+ * must not change meanwhile.  mpool_foreach() calls `cb' on every
+ * live region until it returns non zero, and returns that value.
+ */
+struct mpool_iter {
+	struct	mpool *mi_mp;
+	int	mi_bit;		/* Next region to look at */
+	int	mi_end;		/* First region past the range */
+};
+
+/*
+ * A pool can also live in memory the caller provides, e.g. a shared
+ * file mapping: mpool_memsz() bytes holding the bitmap and then the
+ * regions.  Such pools are committed up front and mpool_free() leaves
+ * the memory alone.
+ */
 int	mpool_init(struct mpool **,char *,int,size_t);
+size_t	mpool_memsz(int,size_t);
+int	mpool_init_mem(struct mpool **,char *,int,size_t,void *,size_t);
 void	mpool_free(struct mpool *);
+int	mpool_rget(struct mpool *,int);
+void	mpool_rput(struct mpool *,int);
+void	mpool_trim(struct mpool *,int);
+void	mpool_iter_init(struct mpool_iter *,struct mpool *,int,int);
+void	*mpool_iter_next(struct mpool_iter *);
+int	mpool_foreach(struct mpool *,int (*)(void *,void *),void *);
 
 #endif	/* M_POOL_H */
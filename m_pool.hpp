@@ -0,0 +1,403 @@
+/* $Id: m_pool.hpp,v 1.1 2003/01/27 21:14:52 te Exp $ */
+
+/*
+ * Copyright (c) 2003 Tamer Embaby <tsemba@menanet.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Typed front end to m_pool.  mpool_of<T, N> holds up to N objects of
+ * type T; the slot size is a compile time constant, so giving a slot
+ * back costs a shift or a multiplication instead of the division by
+ * mp_rsiz of mpool_reclaim(), and only a T * is taken back.
+ *
+ *	mpool_of<conn, 4096> conns("conns");
+ *	conn *c = conns.make(fd);
+ *	...
+ *	conns.destroy(c);
+ *
+ * With Inline true the bitmap and the slots are members of the pool
+ * object, e.g. for a static pool; otherwise they come from
+ * mpool_init(), large pools being committed lazily.  Either way pool()
+ * gives the underlying struct mpool for mpool_foreach() and friends.
+ * mpool_of<T, N>::ptr owns one object and destroys it when it goes,
+ * make_ptr() returns one with C++11.  mp_bench.cc times it against
+ * the macros.
+ */
+
+#if !defined (M_POOL_HPP)
+# define M_POOL_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#if __cplusplus >= 201103L
+# include <utility>
+#endif	/* __cplusplus */
+
+extern "C" {
+#include <m_pool.h>
+}
+
+#if __cplusplus >= 201103L
+# define MPOOL_ALIGNOF(T)	alignof(T)
+#else
+# define MPOOL_ALIGNOF(T)	__alignof__(T)
+#endif	/* __cplusplus */
+
+/* Where the bitmap and slots of an mpool_of live: mpool_init() */
+template <int N, std::size_t Size, std::size_t Align, bool Inline>
+class mpool_store {
+public:
+	mpool_store() : mp_(0) {}
+
+	~mpool_store()
+	{
+
+		if (mp_ != 0)
+			mpool_free(mp_);
+	}
+
+	struct mpool *
+	init(const char *label)
+	{
+
+		if (mpool_init(&mp_, const_cast<char *>(label), N, Size) < 0)
+			mp_ = 0;
+		return (mp_);
+	}
+
+private:
+	struct mpool *mp_;
+};
+
+/* or right here */
+template <int N, std::size_t Size, std::size_t Align>
+class mpool_store<N, Size, Align, true> {
+public:
+	struct mpool *
+	init(const char *label)
+	{
+
+		std::memset(&mp_, 0, sizeof(mp_));
+		std::memset(bmap_, 0, sizeof(bmap_));
+		mp_.mp_label = const_cast<char *>(label);
+		mp_.mp_rsiz = Size;
+		mp_.mp_base = slots_.c;
+		mp_.mp_nobjs = N;
+		mp_.mp_bmapsz = BMAP_SIZE(N);
+		mp_.mp_bmap = bmap_;
+		mp_.mp_maxbytes = BMAP_SIZE(N) >> 3;
+		mp_.mp_flags = MPOOL_EXTMEM;
+		return (&mp_);
+	}
+
+private:
+	struct	mpool mp_;
+	u_char	bmap_[BMAP_SIZE(N) >> 3];
+#if __cplusplus >= 201103L
+	union alignas(Align) {
+#else
+	union {
+		long double ld;		/* Fundamental alignments only */
+		long long ll;
+		void	*p;
+#endif	/* __cplusplus */
+		u_char	c[N * Size];
+	} slots_;
+};
+
+/* First clear bit of a bitmap byte that has one */
+static inline int
+mpool_ffc(u_char c)
+{
+
+#if defined (__GNUC__)
+	return (__builtin_ctz(~c));
+#else
+	int b;
+
+	for (b = 0; c & 1; b++)
+		c >>= 1;
+	return (b);
+#endif	/* __GNUC__ */
+}
+
+template <class T, int N, bool Inline = false>
+class mpool_of {
+public:
+	/* Slot alignment and size, also what mpool_init() rounds to */
+	static const std::size_t slot_align =
+	    MPOOL_ALIGNOF(T) > sizeof(long) ? MPOOL_ALIGNOF(T) : sizeof(long);
+	static const std::size_t slot_size =
+	    (sizeof(T) + slot_align - 1) / slot_align * slot_align;
+
+	class ptr;
+
+#if __cplusplus >= 201103L
+	static_assert(Inline || slot_align <= alignof(std::max_align_t),
+	    "over-aligned types need Inline storage");
+#endif	/* __cplusplus */
+
+	explicit
+	mpool_of(const char *label = "mpool_of")
+	{
+
+		if ((mp_ = st_.init(label)) == 0)
+			throw std::bad_alloc();
+	}
+
+	/* A slot for a T, not constructed, 0 if the pool is full */
+	void *
+	get()
+	{
+		struct mpool *mp = mp_;
+		int byte, n, b;
+		u_char c;
+
+		/* Round robin from mp_rraptr, wrapping around once */
+		for (n = 0, byte = mp->mp_rraptr; n < mp->mp_maxbytes; n++) {
+			if ((c = mp->mp_bmap[byte]) == 0xff) {
+				if (++byte == mp->mp_maxbytes)
+					byte = 0;
+				continue;
+			}
+			b = mpool_ffc(c);
+			if ((byte << 3) + b >= N) {
+				byte = 0;
+				continue;
+			}
+			c |= 1 << b;
+			b += byte << 3;
+			if (mp->mp_rlive != 0 && mpool_rget(mp, b) < 0)
+				break;
+			mp->mp_rraptr = byte;
+			mp->mp_bmap[byte] = c;
+			mp->mp_nscan += n + 1;
+			if (n + 1 > mp->mp_maxscan)
+				mp->mp_maxscan = n + 1;
+			++mp->mp_nalloc;
+			++mp->mp_areq;
+			POOL_PEEK(mp);
+			return (mp->mp_base + (std::size_t)b * slot_size);
+		}
+		++mp->mp_afail;
+		return (0);
+	}
+
+	/* Give back the slot of `p', whose T is already destroyed */
+	void
+	put(T *p)
+	{
+		struct mpool *mp = mp_;
+		std::size_t off;
+		int b;
+
+		off = reinterpret_cast<u_char *>(p) - mp->mp_base;
+		b = (int)(off / slot_size);
+		if (off >= (std::size_t)N * slot_size || off % slot_size != 0) {
+			MPOOL_LOG(("mpool_of::put(%s, 0x%lx): not a slot\n",
+			    mp->mp_label, (unsigned long)p));
+			++mp->mp_rfail;
+			return;
+		}
+		if (bit_test(mp->mp_bmap, b) == 0) {
+			MPOOL_LOG(("mpool_of::put(%s, %d): region is already "
+			    "free\n", mp->mp_label, b));
+			++mp->mp_rfail;
+			return;
+		}
+		bit_clear(mp->mp_bmap, b);
+		--mp->mp_nalloc;
+		++mp->mp_rreq;
+		if (mp->mp_rlive != 0)
+			mpool_rput(mp, b);
+	}
+
+	/* Construct a T in a new slot, 0 if the pool is full */
+#if __cplusplus >= 201103L
+	template <class... A>
+	T *
+	make(A &&...a)
+	{
+		void *p;
+
+		if ((p = get()) == 0)
+			return (0);
+		try {
+			return (new (p) T(std::forward<A>(a)...));
+		} catch (...) {
+			put(static_cast<T *>(p));
+			throw;
+		}
+	}
+#else
+	T *
+	make()
+	{
+		void *p;
+
+		if ((p = get()) == 0)
+			return (0);
+		try {
+			return (new (p) T());
+		} catch (...) {
+			put(static_cast<T *>(p));
+			throw;
+		}
+	}
+
+	template <class A1>
+	T *
+	make(const A1 &a1)
+	{
+		void *p;
+
+		if ((p = get()) == 0)
+			return (0);
+		try {
+			return (new (p) T(a1));
+		} catch (...) {
+			put(static_cast<T *>(p));
+			throw;
+		}
+	}
+
+	template <class A1, class A2>
+	T *
+	make(const A1 &a1, const A2 &a2)
+	{
+		void *p;
+
+		if ((p = get()) == 0)
+			return (0);
+		try {
+			return (new (p) T(a1, a2));
+		} catch (...) {
+			put(static_cast<T *>(p));
+			throw;
+		}
+	}
+#endif	/* __cplusplus */
+
+#if __cplusplus >= 201103L
+	/* make() into a handle */
+	template <class... A>
+	ptr
+	make_ptr(A &&...a)
+	{
+
+		return (ptr(*this, make(std::forward<A>(a)...)));
+	}
+#endif	/* __cplusplus */
+
+	void
+	destroy(T *p)
+	{
+
+		if (p == 0)
+			return;
+		p->~T();
+		put(p);
+	}
+
+	struct mpool *
+	pool() const
+	{
+
+		return (mp_);
+	}
+
+	int
+	size() const
+	{
+
+		return (mp_->mp_nalloc);
+	}
+
+private:
+	mpool_store<N, slot_size, slot_align, Inline> st_;
+	struct mpool *mp_;
+
+	mpool_of(const mpool_of &);
+	mpool_of &operator=(const mpool_of &);
+};
+
+/* Owns one object of an mpool_of, destroyed when the handle goes */
+template <class T, int N, bool Inline>
+class mpool_of<T, N, Inline>::ptr {
+public:
+	ptr() : pool_(0), p_(0) {}
+	ptr(mpool_of &pool, T *p) : pool_(&pool), p_(p) {}
+	~ptr() { reset(); }
+
+#if __cplusplus >= 201103L
+	ptr(ptr &&o) : pool_(o.pool_), p_(o.release()) {}
+
+	ptr &
+	operator=(ptr &&o)
+	{
+
+		if (this != &o) {
+			reset();
+			pool_ = o.pool_;
+			p_ = o.release();
+		}
+		return (*this);
+	}
+#endif	/* __cplusplus */
+
+	T *get() const { return (p_); }
+	T &operator*() const { return (*p_); }
+	T *operator->() const { return (p_); }
+
+	/* Hand the object over to the caller */
+	T *
+	release()
+	{
+		T *p = p_;
+
+		p_ = 0;
+		return (p);
+	}
+
+	void
+	reset()
+	{
+
+		if (p_ != 0)
+			pool_->destroy(p_);
+		p_ = 0;
+	}
+
+private:
+	mpool_of *pool_;
+	T	*p_;
+
+	ptr(const ptr &);
+	ptr &operator=(const ptr &);
+};
+
+#endif	/* M_POOL_HPP */
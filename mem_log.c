@@ -0,0 +1,795 @@
+/* $Id: mem_log.c,v 1.1 2003/01/25 16:02:50 te Exp $ */
+
+/*
+ * Copyright (c) 2003 Tamer Embaby <tsemba@menanet.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Log sink of mem_watch.  MLOG() used to be printf(), so an error
+ * storm (an exhausted pool, a stream of bad frees) turned into a storm
+ * of stdio lock round trips from inside the allocator.  Instead:
+ *
+ * - every MLOG() call site logs at most MEM_LOG_BURST records a
+ *   second, the number dropped is told with the next record of the
+ *   site, or by the flusher once the site went quiet;
+ * - logging copies the format pointer and the arguments into a ring
+ *   buffer of the calling thread, nothing is formatted;
+ * - the flusher thread (MEM_THREADS) or, without threads, the logging
+ *   code when the ring is half full formats the records as text, JSON
+ *   lines or binary records (struct mem_logrec) and hands them to the
+ *   sink, write(2) to stdout by default (see mem_log_sink().)
+ *
+ * When a ring is full records are dropped and counted, logging never
+ * waits.
+ */
+
+#include <sys/types.h>
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined (MEM_THREADS)
+# include <pthread.h>
+#endif	/* MEM_THREADS */
+
+#include <mem_log.h>
+
+/* Ring buffer per thread, a power of 2 */
+#if !defined (MEM_LOG_RING)
+# define MEM_LOG_RING		(64 * 1024)
+#endif	/* MEM_LOG_RING */
+
+/* Records per call site and second */
+#if !defined (MEM_LOG_BURST)
+# define MEM_LOG_BURST		10
+#endif	/* MEM_LOG_BURST */
+
+#if !defined (MEM_LOG_FLUSH_MS)
+# define MEM_LOG_FLUSH_MS	100
+#endif	/* MEM_LOG_FLUSH_MS */
+
+#define MEM_LOG_MAXARGS		16
+#define MEM_LOG_STRMAX		256	/* Longest string argument kept */
+#define MEM_LOG_MSGMAX		2048	/* Longest formatted message */
+#define MEM_LOG_OUTSIZ		(16 * 1024)
+
+#define MEM_LOG_ALIGN(n)	(((n) + 7) & ~7)
+
+union mem_logarg {
+	long long la_i;
+	unsigned long long la_u;
+	double	la_d;
+	const	void *la_p;
+	size_t	la_s;		/* Offset of a copied string */
+};
+
+/* Record in a ring: header, arguments, then copied strings */
+struct mem_logent {
+	u_int	le_len;		/* 0 pads to the end of the ring */
+	u_int	le_nargs;
+	u_int	le_suppressed;
+	struct	mem_logsite *le_site;
+	const	char *le_fmt;
+	unsigned long long le_nsec;
+	union	mem_logarg le_args[MEM_LOG_MAXARGS];
+};
+
+#define MEM_LOG_HDRSIZ		offsetof(struct mem_logent, le_args)
+/* Offset of the copied strings, they follow the arguments */
+#define MEM_LOG_STRINGS(le)	\
+	(MEM_LOG_HDRSIZ + (le)->le_nargs * sizeof(union mem_logarg))
+#define MEM_LOG_MAXREC		\
+	(sizeof(struct mem_logent) + MEM_LOG_MAXARGS * MEM_LOG_STRMAX)
+
+/*
+ * Single producer (the owning thread), single consumer (whoever holds
+ * the flush lock) ring.  Offsets run freely, masked when used.
+ */
+struct mem_logring {
+	struct	mem_logring *lr_next;
+	volatile u_int lr_head;
+	volatile u_int lr_tail;
+	volatile int lr_free;	/* Owner exited, may be taken over */
+	u_long	lr_dropped;
+	unsigned long long lr_buf[MEM_LOG_RING / 8];
+};
+
+/* A conversion of a format string */
+struct mem_logspec {
+	char	sp_fmt[32];	/* Rewritten for the stored argument */
+	int	sp_conv;
+	int	sp_lmod;	/* 0, h, H (hh), l, q (ll), z, j, t, L */
+};
+
+static	struct mem_logring *_mem_log_rings = NULL;
+static	struct mem_logsite *_mem_log_sites = NULL;
+static	mem_logsink_t _mem_log_sink = NULL;
+static	void *_mem_log_arg = NULL;
+static	int _mem_log_fmt = MEM_LOG_TEXT;
+static	int _mem_log_init = 0;
+static	char _mem_log_out[MEM_LOG_OUTSIZ];	/* Under the flush lock */
+static	size_t _mem_log_olen = 0;
+#if defined (MEM_THREADS)
+static	__thread struct mem_logring *_mem_log_ring;
+static	__thread struct mem_logsite *_mem_log_cur;
+static	pthread_mutex_t _mem_log_flock = PTHREAD_MUTEX_INITIALIZER;
+static	pthread_key_t _mem_log_key;
+# define MEM_LOG_FLOCK()	pthread_mutex_lock(&_mem_log_flock)
+# define MEM_LOG_FUNLOCK()	pthread_mutex_unlock(&_mem_log_flock)
+#else
+static	struct mem_logring *_mem_log_ring;
+static	struct mem_logsite *_mem_log_cur;
+static	int _mem_log_flushing = 0;
+# define MEM_LOG_FLOCK()
+# define MEM_LOG_FUNLOCK()
+#endif	/* MEM_THREADS */
+
+static	void mem_log_rec(const char *, ...);
+static	void mem_log_drop(const char *, ...);
+static	void mem_log_stdout(void *,const void *,size_t);
+static	void mem_log_drain(struct mem_logring *);
+#if defined (MEM_THREADS)
+static	void mem_log_prefork(void);
+static	void mem_log_postfork(void);
+static	void mem_log_child(void);
+#endif	/* MEM_THREADS */
+
+static unsigned long long
+mem_log_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ((unsigned long long)ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
+
+/*
+ * Parse the conversion following the `%' at `p', returns what follows
+ * it.  Integer conversions are rewritten to take a long long unless
+ * they take an int.
+ */
+static const char *
+mem_log_parse(p, sp)
+	const	char *p;
+	struct	mem_logspec *sp;
+{
+	char *o, *e;
+
+	o = sp->sp_fmt;
+	e = &sp->sp_fmt[sizeof(sp->sp_fmt) - 4];
+	*o++ = '%';
+	while (*p != '\0' && strchr("-+ #0123456789.", *p) != NULL) {
+		if (o < e)
+			*o++ = *p;
+		p++;
+	}
+	sp->sp_lmod = 0;
+	switch (*p) {
+	case 'h':
+		sp->sp_lmod = *++p == 'h' ? (p++, 'H') : 'h';
+		break;
+	case 'l':
+		sp->sp_lmod = *++p == 'l' ? (p++, 'q') : 'l';
+		break;
+	case 'q': case 'z': case 'j': case 't': case 'L':
+		sp->sp_lmod = *p++;
+		break;
+	}
+	sp->sp_conv = *p;
+	if (*p != '\0')
+		p++;
+	switch (sp->sp_conv) {
+	case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+		if (sp->sp_lmod == 'h')
+			*o++ = 'h';
+		else if (sp->sp_lmod == 'H') {
+			*o++ = 'h';
+			*o++ = 'h';
+		} else if (sp->sp_lmod != 0) {
+			*o++ = 'l';
+			*o++ = 'l';
+		}
+		break;
+	}
+	*o++ = (char)sp->sp_conv;
+	*o = '\0';
+	return (p);
+}
+
+/*
+ * Copy the arguments of `fmt' after the header in `le', returns the
+ * length of the record.
+ */
+static u_int
+mem_log_capture(le, fmt, ap)
+	struct	mem_logent *le;
+	const	char *fmt;
+	va_list	ap;
+{
+	struct mem_logspec sp;
+	union mem_logarg *a;
+	char str[MEM_LOG_MAXARGS * MEM_LOG_STRMAX];
+	const char *p, *s;
+	size_t slen, n;
+	int sign;
+
+	slen = 0;
+	le->le_nargs = 0;
+	for (p = fmt; *p != '\0' && le->le_nargs < MEM_LOG_MAXARGS; ) {
+		if (*p++ != '%')
+			continue;
+		p = mem_log_parse(p, &sp);
+		a = &le->le_args[le->le_nargs];
+		sign = 0;
+		switch (sp.sp_conv) {
+		case 'd': case 'i':
+			sign = 1;
+			/* FALLTHROUGH */
+		case 'o': case 'u': case 'x': case 'X': case 'c':
+			switch (sp.sp_lmod) {
+			case 'l': case 'z': case 't':
+				a->la_i = sign ? (long long)va_arg(ap, long) :
+				    (long long)va_arg(ap, u_long);
+				break;
+			case 'q': case 'j':
+				a->la_i = va_arg(ap, long long);
+				break;
+			default:
+				a->la_i = sign ? (long long)va_arg(ap, int) :
+				    (long long)va_arg(ap, u_int);
+				break;
+			}
+			break;
+		case 'e': case 'E': case 'f': case 'F': case 'g': case 'G':
+		case 'a': case 'A':
+			if (sp.sp_lmod == 'L')
+				a->la_d = (double)va_arg(ap, long double);
+			else
+				a->la_d = va_arg(ap, double);
+			break;
+		case 's':
+			if ((s = va_arg(ap, const char *)) == NULL)
+				s = "(null)";
+			n = strlen(s);
+			if (n >= MEM_LOG_STRMAX)
+				n = MEM_LOG_STRMAX - 1;
+			a->la_s = slen;
+			memcpy(&str[slen], s, n);
+			str[slen + n] = '\0';
+			slen += n + 1;
+			break;
+		case 'p': case 'n':
+			a->la_p = va_arg(ap, const void *);
+			break;
+		default:
+			/* %% or garbage, no argument */
+			continue;
+		}
+		++le->le_nargs;
+	}
+	n = MEM_LOG_STRINGS(le);
+	memcpy((char *)le + n, str, slen);
+	return ((u_int)MEM_LOG_ALIGN(n + slen));
+}
+
+/* Ring of the calling thread, NULL if none could be had */
+static struct mem_logring *
+mem_log_ring()
+{
+	struct mem_logring *r;
+
+	if ((r = _mem_log_ring) != NULL)
+		return (r);
+	/* Take over the ring of a thread that exited */
+	for (r = _mem_log_rings; r != NULL; r = r->lr_next)
+		if (r->lr_free && r->lr_head == r->lr_tail &&
+		    __sync_bool_compare_and_swap(&r->lr_free, 1, 0))
+			break;
+	if (r == NULL) {
+		if ((r = calloc(1, sizeof(*r))) == NULL)
+			return (NULL);
+		do {
+			r->lr_next = _mem_log_rings;
+		} while (!__sync_bool_compare_and_swap(&_mem_log_rings,
+		    r->lr_next, r));
+	}
+	_mem_log_ring = r;
+#if defined (MEM_THREADS)
+	if (_mem_log_init)
+		pthread_setspecific(_mem_log_key, r);
+#endif	/* MEM_THREADS */
+	return (r);
+}
+
+/*
+ * Rate limit the call site `ls' and return the function recording
+ * the message.
+ */
+mem_logfn_t
+mem_log_at(ls)
+	struct	mem_logsite *ls;
+{
+	struct timespec ts;
+
+	if (ls->ls_linked == 0 &&
+	    __sync_bool_compare_and_swap(&ls->ls_linked, 0, 1)) {
+		do {
+			ls->ls_next = _mem_log_sites;
+		} while (!__sync_bool_compare_and_swap(&_mem_log_sites,
+		    ls->ls_next, ls));
+	}
+	clock_gettime(CLOCK_REALTIME, &ts);
+	if (ls->ls_window != (u_long)ts.tv_sec) {
+		ls->ls_window = (u_long)ts.tv_sec;
+		ls->ls_count = 0;
+	}
+	if (++ls->ls_count > MEM_LOG_BURST) {
+		__sync_fetch_and_add(&ls->ls_suppressed, 1);
+		return (mem_log_drop);
+	}
+	_mem_log_cur = ls;
+	return (mem_log_rec);
+}
+
+static void
+mem_log_drop(const char *fmt, ...)
+{
+
+	return;
+}
+
+static void
+mem_log_rec(const char *fmt, ...)
+{
+	union {
+		struct	mem_logent e;
+		char	b[MEM_LOG_MAXREC];
+	} u;
+	struct mem_logring *r;
+	va_list ap;
+	u_int len, head, off, contig;
+	char *buf;
+
+	if ((r = mem_log_ring()) == NULL)
+		return;
+	u.e.le_site = _mem_log_cur;
+	u.e.le_fmt = fmt;
+	u.e.le_nsec = mem_log_now();
+	u.e.le_suppressed = __sync_fetch_and_and(&_mem_log_cur->ls_suppressed,
+	    0);
+	va_start(ap, fmt);
+	len = u.e.le_len = mem_log_capture(&u.e, fmt, ap);
+	va_end(ap);
+
+	head = r->lr_head;
+	off = head & (MEM_LOG_RING - 1);
+	contig = MEM_LOG_RING - off;
+	if (MEM_LOG_RING - (head - r->lr_tail) <
+	    len + (contig < len ? contig : 0)) {
+		++r->lr_dropped;
+		return;
+	}
+	buf = (char *)r->lr_buf;
+	if (contig < len) {
+		*(u_int *)(buf + off) = 0;
+		head += contig;
+		off = 0;
+	}
+	memcpy(buf + off, &u.e, len);
+	__sync_synchronize();
+	r->lr_head = head + len;
+#if !defined (MEM_THREADS)
+	if (r->lr_head - r->lr_tail > MEM_LOG_RING / 2 && !_mem_log_flushing)
+		mem_log_flush();
+#endif	/* !MEM_THREADS */
+	return;
+}
+
+/*
+ * Format the message of record `le' into `buf', returns its length
+ * without the trailing newline.
+ */
+static size_t
+mem_log_message(le, buf, len)
+	struct	mem_logent *le;
+	char	*buf;
+	size_t	len;
+{
+	struct mem_logspec sp;
+	union mem_logarg *a;
+	const char *p;
+	size_t o;
+	int n;
+
+	o = 0;
+	a = le->le_args;
+	for (p = le->le_fmt; *p != '\0' && o < len - 1; ) {
+		if (*p != '%') {
+			buf[o++] = *p++;
+			continue;
+		}
+		p = mem_log_parse(p + 1, &sp);
+		n = 0;
+		if (a >= &le->le_args[le->le_nargs] && sp.sp_conv != '%')
+			break;
+		switch (sp.sp_conv) {
+		case '%':
+			buf[o++] = '%';
+			continue;
+		case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+		case 'c':
+			if (sp.sp_lmod == 0 || sp.sp_lmod == 'h' ||
+			    sp.sp_lmod == 'H' || sp.sp_conv == 'c')
+				n = snprintf(buf + o, len - o, sp.sp_fmt,
+				    (int)a->la_i);
+			else
+				n = snprintf(buf + o, len - o, sp.sp_fmt,
+				    a->la_i);
+			break;
+		case 'e': case 'E': case 'f': case 'F': case 'g': case 'G':
+		case 'a': case 'A':
+			n = snprintf(buf + o, len - o, sp.sp_fmt, a->la_d);
+			break;
+		case 's':
+			n = snprintf(buf + o, len - o, sp.sp_fmt,
+			    (const char *)le + MEM_LOG_STRINGS(le) + a->la_s);
+			break;
+		case 'p':
+			n = snprintf(buf + o, len - o, sp.sp_fmt, a->la_p);
+			break;
+		case 'n':
+			break;
+		default:
+			continue;
+		}
+		a++;
+		if (n > 0)
+			o += (size_t)n < len - o ? (size_t)n : len - o - 1;
+	}
+	buf[o] = '\0';
+	while (o > 0 && buf[o - 1] == '\n')
+		buf[--o] = '\0';
+	return (o);
+}
+
+/* Append `len' bytes to the output, flushing it to the sink if full */
+static void
+mem_log_out(p, len)
+	const	void *p;
+	size_t	len;
+{
+
+	if (_mem_log_olen + len > sizeof(_mem_log_out)) {
+		(*_mem_log_sink)(_mem_log_arg, _mem_log_out, _mem_log_olen);
+		_mem_log_olen = 0;
+	}
+	if (len > sizeof(_mem_log_out)) {
+		(*_mem_log_sink)(_mem_log_arg, p, len);
+		return;
+	}
+	memcpy(_mem_log_out + _mem_log_olen, p, len);
+	_mem_log_olen += len;
+	return;
+}
+
+/*
+ * Write one record in the output format, `msg' may be empty for a
+ * suppression count only.
+ */
+static void
+mem_log_emit(ls, nsec, suppressed, msg, mlen)
+	struct	mem_logsite *ls;
+	unsigned long long nsec;
+	u_int	suppressed;
+	const	char *msg;
+	size_t	mlen;
+{
+	struct mem_logrec lr;
+	char line[MEM_LOG_MSGMAX * 2 + 512];
+	const char *p;
+	size_t o;
+	int n;
+
+	switch (_mem_log_fmt) {
+	case MEM_LOG_BINARY:
+		lr.lr_flen = (unsigned short)strlen(ls->ls_file);
+		lr.lr_mlen = (unsigned short)mlen;
+		lr.lr_len = sizeof(lr) + lr.lr_flen + lr.lr_mlen;
+		lr.lr_line = ls->ls_line;
+		lr.lr_suppressed = suppressed;
+		lr.lr_nsec = nsec;
+		mem_log_out(&lr, sizeof(lr));
+		mem_log_out(ls->ls_file, lr.lr_flen);
+		mem_log_out(msg, mlen);
+		break;
+	case MEM_LOG_JSON:
+		n = snprintf(line, sizeof(line), "{\"ts\":%llu.%09llu,"
+		    "\"file\":\"%s\",\"line\":%d,\"suppressed\":%u,\"msg\":\"",
+		    nsec / 1000000000, nsec % 1000000000, ls->ls_file,
+		    ls->ls_line, suppressed);
+		o = (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1;
+		for (p = msg; p < msg + mlen && o < sizeof(line) - 8; p++) {
+			if (*p == '"' || *p == '\\') {
+				line[o++] = '\\';
+				line[o++] = *p;
+			} else if ((u_char)*p < 0x20)
+				o += snprintf(line + o, sizeof(line) - o,
+				    "\\u%04x", (u_char)*p);
+			else
+				line[o++] = *p;
+		}
+		line[o++] = '"';
+		line[o++] = '}';
+		line[o++] = '\n';
+		mem_log_out(line, o);
+		break;
+	default:
+		if (suppressed != 0) {
+			n = snprintf(line, sizeof(line), "%s:%d: %u similar "
+			    "messages suppressed\n", ls->ls_file, ls->ls_line,
+			    suppressed);
+			mem_log_out(line, (size_t)n < sizeof(line) ?
+			    (size_t)n : sizeof(line) - 1);
+		}
+		if (mlen != 0) {
+			mem_log_out(msg, mlen);
+			mem_log_out("\n", 1);
+		}
+		break;
+	}
+	return;
+}
+
+/* Format all records of ring `r', with the flush lock held */
+static void
+mem_log_drain(r)
+	struct	mem_logring *r;
+{
+	struct mem_logent *le;
+	char msg[MEM_LOG_MSGMAX];
+	u_int tail, off;
+	size_t mlen;
+
+	tail = r->lr_tail;
+	while (tail != r->lr_head) {
+		__sync_synchronize();
+		off = tail & (MEM_LOG_RING - 1);
+		le = (struct mem_logent *)((char *)r->lr_buf + off);
+		if (le->le_len == 0) {
+			tail += MEM_LOG_RING - off;
+			continue;
+		}
+		mlen = mem_log_message(le, msg, sizeof(msg));
+		mem_log_emit(le->le_site, le->le_nsec, le->le_suppressed, msg,
+		    mlen);
+		tail += le->le_len;
+		__sync_synchronize();
+		r->lr_tail = tail;
+	}
+	return;
+}
+
+/*
+ * Write out everything logged so far, and the suppression counts of
+ * the sites that went quiet.
+ */
+void
+mem_log_flush()
+{
+	struct mem_logring *r;
+	struct mem_logsite *ls;
+	u_long now;
+	u_int n;
+
+	MEM_LOG_FLOCK();
+#if !defined (MEM_THREADS)
+	_mem_log_flushing = 1;
+#endif	/* !MEM_THREADS */
+	if (_mem_log_sink == NULL)
+		_mem_log_sink = mem_log_stdout;
+	for (r = _mem_log_rings; r != NULL; r = r->lr_next)
+		mem_log_drain(r);
+	now = (u_long)(mem_log_now() / 1000000000);
+	for (ls = _mem_log_sites; ls != NULL; ls = ls->ls_next)
+		if (ls->ls_suppressed != 0 && ls->ls_window < now &&
+		    (n = __sync_fetch_and_and(&ls->ls_suppressed, 0)) != 0)
+			mem_log_emit(ls, mem_log_now(), n, "", 0);
+	if (_mem_log_olen != 0) {
+		(*_mem_log_sink)(_mem_log_arg, _mem_log_out, _mem_log_olen);
+		_mem_log_olen = 0;
+	}
+#if !defined (MEM_THREADS)
+	_mem_log_flushing = 0;
+#endif	/* !MEM_THREADS */
+	MEM_LOG_FUNLOCK();
+	return;
+}
+
+/* Default sink */
+static void
+mem_log_stdout(arg, buf, len)
+	void	*arg;
+	const	void *buf;
+	size_t	len;
+{
+	const char *p;
+	ssize_t n;
+
+	/* Keep the order with the reports printed to stdout */
+	fflush(stdout);
+	for (p = buf; len > 0; p += n, len -= n)
+		if ((n = write(STDOUT_FILENO, p, len)) <= 0)
+			break;
+	return;
+}
+
+#if defined (MEM_THREADS)
+
+static void *
+mem_log_flusher(arg)
+	void	*arg;
+{
+	struct timespec ts;
+
+	ts.tv_sec = MEM_LOG_FLUSH_MS / 1000;
+	ts.tv_nsec = (MEM_LOG_FLUSH_MS % 1000) * 1000000;
+	for (;;) {
+		nanosleep(&ts, NULL);
+		mem_log_flush();
+	}
+	/* NOTREACHED */
+	return (arg);
+}
+
+/* The ring of an exiting thread may be taken over once drained */
+static void
+mem_log_exit(arg)
+	void	*arg;
+{
+	struct mem_logring *r = arg;
+
+	r->lr_free = 1;
+	return;
+}
+
+/*
+ * fork() handlers: the parent keeps the flush lock across the fork;
+ * the child gets a fresh lock and flusher and drops whatever was
+ * still queued, the parent prints that.  Rings of the threads that
+ * did not follow are freed for reuse.
+ */
+static void
+mem_log_prefork()
+{
+
+	mem_log_flush();
+	MEM_LOG_FLOCK();
+	return;
+}
+
+static void
+mem_log_postfork()
+{
+
+	MEM_LOG_FUNLOCK();
+	return;
+}
+
+static void
+mem_log_child()
+{
+	struct mem_logring *r;
+	pthread_t tid;
+
+	pthread_mutex_init(&_mem_log_flock, NULL);
+	for (r = _mem_log_rings; r != NULL; r = r->lr_next) {
+		r->lr_tail = r->lr_head;
+		if (r != _mem_log_ring)
+			r->lr_free = 1;
+	}
+	_mem_log_olen = 0;
+	if (pthread_create(&tid, NULL, mem_log_flusher, NULL) == 0)
+		pthread_detach(tid);
+	return;
+}
+
+#endif	/* MEM_THREADS */
+
+/*
+ * Start the flusher, also flush at exit.
+ */
+void
+mem_log_init()
+{
+#if defined (MEM_THREADS)
+	pthread_t tid;
+#endif	/* MEM_THREADS */
+
+	if (_mem_log_init != 0)
+		return;
+	++_mem_log_init;
+	if (_mem_log_sink == NULL)
+		_mem_log_sink = mem_log_stdout;
+	atexit(mem_log_flush);
+#if defined (MEM_THREADS)
+	pthread_key_create(&_mem_log_key, mem_log_exit);
+	if (_mem_log_ring != NULL)
+		pthread_setspecific(_mem_log_key, _mem_log_ring);
+	if (pthread_create(&tid, NULL, mem_log_flusher, NULL) == 0)
+		pthread_detach(tid);
+	pthread_atfork(mem_log_prefork, mem_log_postfork, mem_log_child);
+#endif	/* MEM_THREADS */
+	return;
+}
+
+/*
+ * Send the output to `sink', called with `arg', the buffer and its
+ * length.  NULL restores the default (stdout.)
+ */
+void
+mem_log_sink(sink, arg)
+	mem_logsink_t sink;
+	void	*arg;
+{
+
+	mem_log_flush();
+	MEM_LOG_FLOCK();
+	_mem_log_sink = sink != NULL ? sink : mem_log_stdout;
+	_mem_log_arg = arg;
+	MEM_LOG_FUNLOCK();
+	return;
+}
+
+/* MEM_LOG_TEXT, MEM_LOG_JSON or MEM_LOG_BINARY */
+void
+mem_log_format(fmt)
+	int	fmt;
+{
+
+	mem_log_flush();
+	MEM_LOG_FLOCK();
+	_mem_log_fmt = fmt;
+	MEM_LOG_FUNLOCK();
+	return;
+}
+
+/* Records dropped because a ring was full */
+unsigned long
+mem_log_dropped()
+{
+	struct mem_logring *r;
+	u_long n;
+
+	n = 0;
+	for (r = _mem_log_rings; r != NULL; r = r->lr_next)
+		n += r->lr_dropped;
+	return (n);
+}
@@ -0,0 +1,94 @@
+/* $Id: mem_log.h,v 1.1 2003/01/25 16:02:50 te Exp $ */
+
+/*
+ * Copyright (c) 2003 Tamer Embaby <tsemba@menanet.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Buffered log sink of mem_watch, see mem_log.c.
+ */
+
+#if !defined (MEM_LOG_H)
+# define MEM_LOG_H
+
+#include <stddef.h>
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+/* One per MLOG() call, for rate limiting */
+struct mem_logsite {
+	const	char *ls_file;
+	int	ls_line;
+	struct	mem_logsite *ls_next;	/* All sites that logged */
+	int	ls_linked;
+	unsigned long ls_window;	/* Second the counts are for */
+	unsigned int ls_count;		/* Records logged in it */
+	unsigned int ls_suppressed;	/* Dropped since the last one */
+};
+
+typedef	void (*mem_logfn_t)(const char *, ...);
+typedef	void (*mem_logsink_t)(void *, const void *, size_t);
+
+/*
+ * MLOG((fmt, args...)) records a printf-like message; formatting is
+ * done later by the flusher.  No `*' widths, strings are copied.
+ */
+#define MLOG(a)		do {						\
+	static struct mem_logsite __mls = { __FILE__, __LINE__ };	\
+	(*mem_log_at(&__mls)) a;					\
+} while (0)
+
+#define MEM_LOG_TEXT		0	/* Output formats */
+#define MEM_LOG_JSON		1
+#define MEM_LOG_BINARY		2
+
+/*
+ * MEM_LOG_BINARY output: each record is this header followed by
+ * lr_flen bytes of file name and lr_mlen bytes of message.
+ */
+struct mem_logrec {
+	unsigned int lr_len;		/* Whole record */
+	unsigned int lr_line;
+	unsigned int lr_suppressed;	/* Records dropped before it */
+	unsigned short lr_flen;
+	unsigned short lr_mlen;
+	unsigned long long lr_nsec;	/* Wall clock */
+};
+
+mem_logfn_t mem_log_at(struct mem_logsite *);
+void	mem_log_init(void);
+void	mem_log_sink(mem_logsink_t,void *);
+void	mem_log_format(int);
+void	mem_log_flush(void);
+unsigned long mem_log_dropped(void);
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif	/* MEM_LOG_H */
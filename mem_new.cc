@@ -0,0 +1,326 @@
+/* $Id: mem_new.cc,v 1.1 2003/01/20 19:02:11 te Exp $ */
+
+/*
+ * Copyright (c) 2003 Tamer Embaby <tsemba@menanet.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Replacement global operator new and delete, link this in to have a
+ * C++ program's allocations tracked from mem_init() on.  Blocks of
+ * plain and array new are accounted to the "operator new" and
+ * "operator new[]" sites; use mem_allocator (mem_watch.hpp) where
+ * containers should be told apart.  Sized delete passes the size
+ * down, a block deleted with a size other than the one it was
+ * allocated with is reported.
+ *
+ * Blocks allocated before mem_init() are not known to it and are
+ * logged as such when deleted, call it first thing in main().
+ */
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#include <mem_watch.h>
+
+static struct mem_sitedesc _mem_new_sd = {
+	"operator new", 0, MEM_TYPE_ALLOC, { 0, 0, 0 }
+};
+static struct mem_sitedesc _mem_newa_sd = {
+	"operator new[]", 0, MEM_TYPE_ALLOC, { 0, 0, 0 }
+};
+
+/* Allocate like operator new does, `align' 0 for the default */
+static void *
+mem_new(std::size_t size, std::size_t align, struct mem_sitedesc *sd)
+{
+	std::new_handler nh;
+	void *p;
+
+	if (size == 0)
+		size = 1;
+	for (;;) {
+		if (align == 0)
+			p = _mem_malloc_at(size, sd);
+		else
+			p = _mem_memalign_at(align, size, sd);
+		if (p != NULL)
+			return (p);
+		if ((nh = std::set_new_handler(0)) == 0)
+			throw std::bad_alloc();
+		std::set_new_handler(nh);
+		(*nh)();
+	}
+}
+
+static void *
+mem_new_nothrow(std::size_t size, std::size_t align,
+    struct mem_sitedesc *sd) throw()
+{
+
+	try {
+		return (mem_new(size, align, sd));
+	} catch (...) {
+		return (NULL);
+	}
+}
+
+static void
+mem_delete(void *p, std::size_t size, struct mem_sitedesc *sd) throw()
+{
+
+	if (size == (std::size_t)-1)
+		_mem_free_at(p, sd);
+	else
+		_mem_free_sized_at(p, size == 0 ? 1 : size, sd);
+}
+
+void *
+operator new(std::size_t size)
+{
+
+	return (mem_new(size, 0, &_mem_new_sd));
+}
+
+void *
+operator new[](std::size_t size)
+{
+
+	return (mem_new(size, 0, &_mem_newa_sd));
+}
+
+void *
+operator new(std::size_t size, const std::nothrow_t &) throw()
+{
+
+	return (mem_new_nothrow(size, 0, &_mem_new_sd));
+}
+
+void *
+operator new[](std::size_t size, const std::nothrow_t &) throw()
+{
+
+	return (mem_new_nothrow(size, 0, &_mem_newa_sd));
+}
+
+void
+operator delete(void *p) throw()
+{
+
+	mem_delete(p, (std::size_t)-1, &_mem_new_sd);
+}
+
+void
+operator delete[](void *p) throw()
+{
+
+	mem_delete(p, (std::size_t)-1, &_mem_newa_sd);
+}
+
+void
+operator delete(void *p, const std::nothrow_t &) throw()
+{
+
+	mem_delete(p, (std::size_t)-1, &_mem_new_sd);
+}
+
+void
+operator delete[](void *p, const std::nothrow_t &) throw()
+{
+
+	mem_delete(p, (std::size_t)-1, &_mem_newa_sd);
+}
+
+#if defined (__cpp_sized_deallocation)
+void
+operator delete(void *p, std::size_t size) throw()
+{
+
+	mem_delete(p, size, &_mem_new_sd);
+}
+
+void
+operator delete[](void *p, std::size_t size) throw()
+{
+
+	mem_delete(p, size, &_mem_newa_sd);
+}
+#endif	/* __cpp_sized_deallocation */
+
+#if defined (__cpp_aligned_new)
+void *
+operator new(std::size_t size, std::align_val_t al)
+{
+
+	return (mem_new(size, (std::size_t)al, &_mem_new_sd));
+}
+
+void *
+operator new[](std::size_t size, std::align_val_t al)
+{
+
+	return (mem_new(size, (std::size_t)al, &_mem_newa_sd));
+}
+
+void *
+operator new(std::size_t size, std::align_val_t al,
+    const std::nothrow_t &) noexcept
+{
+
+	return (mem_new_nothrow(size, (std::size_t)al, &_mem_new_sd));
+}
+
+void *
+operator new[](std::size_t size, std::align_val_t al,
+    const std::nothrow_t &) noexcept
+{
+
+	return (mem_new_nothrow(size, (std::size_t)al, &_mem_newa_sd));
+}
+
+void
+operator delete(void *p, std::align_val_t) noexcept
+{
+
+	mem_delete(p, (std::size_t)-1, &_mem_new_sd);
+}
+
+void
+operator delete[](void *p, std::align_val_t) noexcept
+{
+
+	mem_delete(p, (std::size_t)-1, &_mem_newa_sd);
+}
+
+void
+operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+
+	mem_delete(p, (std::size_t)-1, &_mem_new_sd);
+}
+
+void
+operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept
+{
+
+	mem_delete(p, (std::size_t)-1, &_mem_newa_sd);
+}
+
+void
+operator delete(void *p, std::size_t size, std::align_val_t) noexcept
+{
+
+	mem_delete(p, size, &_mem_new_sd);
+}
+
+void
+operator delete[](void *p, std::size_t size, std::align_val_t) noexcept
+{
+
+	mem_delete(p, size, &_mem_newa_sd);
+}
+#endif	/* __cpp_aligned_new */
+
+#if defined (MEM_NEW_BENCH)
+
+/*
+ * Container throughput with tracking off (before mem_init()) and on,
+ * through operator new and through mem_allocator:
+ *
+ *	cc -O2 -c -I. -Iwin32 mem_watch.c mem_log.c m_pool.c
+ *	c++ -O2 -DMEM_NEW_BENCH -I. -Iwin32 mem_new.cc mem_watch.o \
+ *	    mem_log.o m_pool.o -lpthread
+ */
+
+#include <sys/time.h>
+#include <cstdio>
+#include <list>
+#include <map>
+#include <vector>
+
+#include <mem_watch.hpp>
+
+#define BENCH_N		5000	/* Live blocks stay under the record pool */
+#define BENCH_ROUNDS	40
+
+static long
+gettimeus()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec*1000000 + tv.tv_usec);
+}
+
+template <class A>
+static long
+bench(void)
+{
+	typedef typename A::template rebind<int>::other IA;
+	typedef typename A::template rebind<std::pair<const int, int> >::other
+	    PA;
+	long us;
+	int i, r;
+
+	us = gettimeus();
+	for (r = 0; r < BENCH_ROUNDS; r++) {
+		std::vector<int, IA> v;
+		std::list<int, IA> l;
+		std::map<int, int, std::less<int>, PA> m;
+
+		for (i = 0; i < BENCH_N; i++) {
+			v.push_back(i);
+			l.push_back(i);
+			m[i] = i;
+		}
+		while (!l.empty()) {
+			l.pop_front();
+			m.erase(m.begin());
+		}
+	}
+	return (gettimeus() - us);
+}
+
+int
+main()
+{
+	long off, on, alloc;
+
+	off = bench<std::allocator<int> >();
+	mem_init();
+	on = bench<std::allocator<int> >();
+	alloc = bench<mem_allocator<int> >();
+	printf("%d rounds of %d elements in vector, list and map:\n",
+	    BENCH_ROUNDS, BENCH_N);
+	printf("\tuntracked      %8ld us\n", off);
+	printf("\toperator new   %8ld us (%.2fx)\n", on, (double)on / off);
+	printf("\tmem_allocator  %8ld us (%.2fx)\n", alloc,
+	    (double)alloc / off);
+	mem_site_stats();
+	return (0);
+}
+
+#endif	/* MEM_NEW_BENCH */
@@ -0,0 +1,87 @@
+/* $Id: mem_pm.h,v 1.1 2003/01/26 15:02:37 te Exp $ */
+
+/*
+ * Copyright (c) 2003 Tamer Embaby <tsemba@menanet.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Layout of the file mem_watch keeps its records in when started with
+ * MEM_WATCH_FILE set, read after the process died by mwpm.  The file
+ * is mapped shared, so whatever the process last wrote survives a
+ * crash.  Everything in it is found by offset from the start of the
+ * file; the links between records are not needed to read it back.
+ *
+ *	header | sites | site names | pool bitmap | records
+ *
+ * A record is live when its bit in the pool bitmap is set.  The
+ * header gives the offsets of the record fields mwpm reads.
+ */
+
+#if !defined (MEM_PM_H)
+# define MEM_PM_H
+
+#define MEM_PM_MAGIC		0x6d77706d	/* "mwpm" */
+#define MEM_PM_VERSION		1
+
+#define MEM_PM_RUNNING		1
+#define MEM_PM_EXITED		2	/* mem_deinit() was called */
+
+struct mem_pm_site {
+	unsigned int ps_file;	/* Offset of the name, 0 if unknown */
+	int	ps_line;
+	int	ps_type;	/* MEM_TYPE_* */
+};
+
+struct mem_pm_hdr {
+	unsigned int ph_magic;
+	unsigned int ph_version;
+	int	ph_pid;
+	volatile int ph_state;
+	long	ph_started;	/* time() at mem_init() */
+	unsigned long ph_len;	/* Bytes of the file */
+
+	/* Site table indexed by site id and the names it points into */
+	unsigned long ph_sites;
+	int	ph_nsites;
+	unsigned long ph_strs;
+	unsigned int ph_strsz;
+	volatile unsigned int ph_strused;
+
+	/* Record pool */
+	unsigned long ph_bmap;
+	unsigned long ph_base;
+	int	ph_nobjs;
+	int	ph_rsiz;
+	int	ph_osid;	/* unsigned int, site id */
+	int	ph_osize;	/* int */
+	int	ph_optr;	/* void *, the block */
+	int	ph_oseq;	/* unsigned long, record number */
+
+	/* Records numbered below were made before the last mem_enable() */
+	volatile unsigned long ph_epoch_seq;
+};
+
+#endif	/* MEM_PM_H */
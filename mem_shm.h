@@ -0,0 +1,82 @@
+/* $Id: mem_shm.h,v 1.1 2003/01/19 18:40:11 te Exp $ */
+
+/*
+ * Copyright (c) 2003 Tamer Embaby <tsemba@menanet.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Layout of the shared memory segment mem_watch publishes its counters
+ * in (see mem_shm_export()), read by mwtop.  The segment is named
+ * MEM_SHM_NAME with the pid of the process filled in.
+ *
+ * The writer makes sh_seq odd while it updates the segment and even
+ * again when done; readers copy the segment and retry if sh_seq was
+ * odd or changed meanwhile.
+ */
+
+#if !defined (MEM_SHM_H)
+# define MEM_SHM_H
+
+#define MEM_SHM_NAME		"/mem_watch.%d"
+#define MEM_SHM_MAGIC		0x6d777368	/* "mwsh" */
+#define MEM_SHM_VERSION		1
+#define MEM_SHM_TOP		32
+#define MEM_SHM_FILE		64
+
+struct mem_shm_site {
+	char	ss_file[MEM_SHM_FILE];	/* Tail of the file name */
+	int	ss_line;
+	unsigned long ss_count;		/* Live blocks */
+	unsigned long ss_bytes;		/* and bytes */
+	double	ss_rate;		/* Allocations per second */
+};
+
+struct mem_shm {
+	unsigned int sh_magic;
+	unsigned int sh_version;
+	volatile unsigned int sh_seq;
+	int	sh_pid;
+	double	sh_uptime;		/* Seconds since mem_init() */
+	unsigned long sh_updates;
+
+	/* Record pool */
+	int	sh_nobjs;
+	int	sh_nalloc;
+	int	sh_napeek;
+	int	sh_afail;
+	unsigned long sh_committed;	/* Bytes */
+	unsigned long sh_reserved;
+
+	unsigned long sh_lbytes;	/* Live bytes and blocks */
+	unsigned long sh_lcount;
+	int	sh_nsites;
+	int	sh_nsnap;		/* Watermark snapshots taken */
+
+	int	sh_ntop;		/* Sites holding most memory */
+	struct	mem_shm_site sh_top[MEM_SHM_TOP];
+};
+
+#endif	/* MEM_SHM_H */
@@ -87,13 +87,43 @@
  * Same concept applies to my_realloc() and my_free() routines by calling
  * mem_realloc_notify() and mem_free_notify() respectivily.
  *
+ * With GCC or clang the wrappers can be macros calling
+ * mem_alloc_notify_here() and friends instead: every call then gets a
+ * static descriptor (see struct mem_sitedesc in mem_watch.h) that
+ * mem_init() numbers at startup, so the notify path goes straight to
+ * the site counters without looking file and line up.
+ *
+ * C++ programs can link mem_new.o, which replaces the global operator
+ * new and delete (sized, aligned and nothrow variants included), and
+ * give containers the mem_allocator<T> of mem_watch.hpp so each
+ * container type is a site of its own.  Sized delete is checked
+ * against the size recorded at allocation.
+ *
+ * Code that frees its objects all together, per request or per
+ * transaction, can track them as an arena instead: blocks passed to
+ * mem_arena_alloc() are appended to a log of the arena begun with
+ * mem_arena_begin(), without a record or a hash lookup each, and
+ * mem_arena_end() drops the whole log at once.  Only arenas that are
+ * never ended show up in the reports.
+ *
  * And then at your program exit call mem_deinit() or at any other
  * approperiate time call mem_stats() to print memory regions that
- * the application forgot about.
+ * the application forgot about.  On Linux mem_deinit() then lists
+ * the regions mem_leaks() finds unreachable: the stacks, data segments
+ * and memory registered with mem_scan_root() are scanned for pointers
+ * into tracked regions, the same way a garbage collector marks, so
+ * long lived caches that are still referenced are not listed.
+ *
+ * Build with MEM_THREADS (and -lpthread) when the application is
+ * multi threaded; mem_watcher then serializes its entry points and
+ * uses several threads for the leak scan.
  *
  * If you encounter non-zero value in ``alloc_fail'' when printing
  * m_pool statistics you should increase the MAX_MEMALLOC_POOL
- * as approperiate.
+ * as approperiate.  Large pools only reserve address space up front,
+ * pages are committed as records are handed out and given back to the
+ * OS after they stay unused for a while (see m_pool.h), so a generous
+ * MAX_MEMALLOC_POOL costs only what is actually tracked.
  *
  * The ``alloc_peek'' value can give indication about maximum number
  * of allocated memory regions at any time. So a alloc_peek value
@@ -104,10 +134,142 @@
  * Mem_watcher will report illegal free() calls so it can be repaired
  * or investigated.
  *
- * Logging is performed by MPOOL_LOG() and MLOG() macros which are
- * just an aliases for printf() by default.  They can by replaced
- * by other printf-like logging routines (or use log.h log.c found
- * on my page) or just hack this code :-).
+ * Besides the hash, live regions are kept in a red-black tree ordered
+ * by address.  mem_lookup() uses it to tell which region (and where
+ * it was allocated) an arbitrary address, e.g. a crash address or a
+ * pointer into the middle of a buffer, belongs to; the leak scan and
+ * the redzone checks use it too, the latter naming the region right
+ * below a block whose front canaries were overwritten.
+ *
+ * Every record is stamped (with the CPU time stamp counter on x86) and
+ * accounted to its file:line.  mem_site_stats() prints per callsite
+ * the number of allocations, their rate and bytes, and percentiles of
+ * how long the freed blocks lived, kept in fixed size log scale
+ * histograms.  Sites allocating at a high rate blocks that die within
+ * microseconds are the ones to give a pool or an arena.  Sites are
+ * listed busiest first along with a histogram of the sizes they asked
+ * for by power of two, which helps picking size classes and pool
+ * sizes; mem_site_next() and mem_site_find() give the same counters
+ * to the application.  Each file:line and kind of call (allocation,
+ * reallocation or free) is interned once into a small dense id, found
+ * without locking on later calls; records, quarantine entries and
+ * counters carry the id instead of file name pointers, which keeps
+ * the records small and makes reallocation sites show up separately.
+ *
+ * mem_stats() lists every record, which takes long on a heap of
+ * millions of blocks.  mem_report(fd, 20) instead sums the live blocks
+ * by site.  Several threads walk the record pool in address order,
+ * finding live records from the pool bitmap a word at a time (see
+ * mpool_iter_next() in m_pool.c), and the 20 sites holding most bytes
+ * are picked with a partial sort.  The report is formatted into
+ * buffers set aside at build time and written with one writev().  The
+ * walking threads are started once, by the first report, so later
+ * reports do not allocate.
+ *
+ * To see what a test case or a request leaves behind, call
+ * g = mem_mark() before it and mem_report_since(g, fd, 20) after.
+ * Every mark starts a generation, and the records are numbered, so
+ * each record belongs to one with no field of its own.  A generation
+ * counts the live blocks and bytes of each site, updated as blocks
+ * come and go, which makes the report independent of the heap size.
+ * The last MEM_GENS generations are kept apart and older ones are
+ * folded into the oldest kept.
+ *
+ * For pprof and the flame graph tooling around it, mem_profile(fd)
+ * writes the allocated and live blocks and bytes of every site as a
+ * gzipped protobuf profile, e.g. "go tool pprof -top heap.pb.gz".
+ * The encoding is done by hand straight from the site table and
+ * streamed as stored deflate blocks through the report buffer, so a
+ * profile takes no memory beyond it however large the heap.
+ *
+ * The tracker also watches itself.  One entry point call in
+ * MEM_SELF_SAMPLE is timed with the cycle counter into counters of
+ * the calling thread, record lookups count the hash chain steps they
+ * take and the pool counts how much of its bitmap it searched.
+ * mem_self() adds these up along with the hash load and the resident
+ * size of the tracker's own tables, and mem_stats() prints them, so a
+ * degrading structure shows before the program slows down.  Build with
+ * MEM_NO_SELF to leave the timing out.
+ *
+ * To catch the moment a long running process starts to bloat, set
+ * watermarks with mem_watermark() on live bytes, live blocks or growth
+ * within an interval.  When one is crossed a snapshot of the sites
+ * holding most memory is written (to stdout or to the files named by
+ * mem_watermark_file()) and the watermark is raised.  The allocation
+ * path pays one counter compare for this.
+ *
+ * mem_shm_export() publishes the pool statistics, live bytes and
+ * blocks and the sites holding most memory in a shared memory segment
+ * (layout in mem_shm.h), refreshed by the reporter thread, and the
+ * mwtop tool shows them live from outside the process:
+ *
+ *	$ mwtop -i 500 <pid>
+ *
+ * A production process can also be made to dump its top sites on a
+ * signal: after mem_signal(SIGUSR2, fd, 1000) a kill -USR2 writes the
+ * latest snapshot to fd.  The snapshot is formatted ahead of time, so
+ * the handler only calls write() and is async-signal-safe.  With
+ * MEM_THREADS, fork() is safe after mem_init(): the tracker is
+ * quiesced while the process forks, and the child starts with fresh
+ * locks, a reporter thread of its own and no exported counters.
+ *
+ * Memory can be charged to subsystems with accounting tags: t =
+ * mem_tag("cache") names one, and mem_tag_set(t) (or MEM_TAG_SCOPE(t)
+ * in C and mem_tag_scope in C++) charges the blocks the thread
+ * allocates from then on to it.  Each thread counts per tag and merges
+ * into the totals in MEM_TAG_FLUSH steps, so mem_tag_info() answers
+ * without walking the records.  mem_tag_budget() sets a soft budget
+ * whose callback runs when the tag goes over it; mem_stats() lists
+ * all tags.
+ *
+ * To keep the records when the process crashes or is killed for
+ * running out of memory, start it with MEM_WATCH_FILE=<file>.  The
+ * record pool and the site names are then placed in that file, mapped
+ * shared, so updating a record costs the same as in anonymous memory.
+ * Live records are found from the pool bitmap and sites by id, so the
+ * file holds no pointers the reader has to follow.  Afterwards
+ *
+ *	$ mwpm [-l] <file>
+ *
+ * lists the blocks that were live by site.  A fork() child moves its
+ * records to <file>.<pid> on its first call.
+ *
+ * Tracking can stay compiled in and be switched at run time: start the
+ * program with MEM_WATCH=0 and turn it on with mem_enable(1) or, with
+ * MEM_WATCH_SIGNAL set to a signal number, by sending that signal.
+ * While off, every entry point costs one predictable test before it
+ * goes to the C library (see MEM_BENCH at the end of this file), but
+ * for frees among the addresses tracked so far while tracked blocks
+ * are still live.  Turning tracking on starts a new epoch.  Blocks
+ * recorded before are left out of the listings.  Blocks allocated
+ * while tracking was off are released quietly, and no lookup is needed
+ * when they lie outside the addresses tracked so far.  Inside them a
+ * counting Bloom filter over the tracked pointers turns most of them
+ * away without the lock, the rest are looked up under it;
+ * mpool_stats() shows its size and false positive rate.  With
+ * MEM_REDZONE, whose pointers malloc() never returned, a pointer
+ * inside them that has no record is reported and never freed.
+ *
+ * Instead of writing its own wrappers an application can use the
+ * mem_malloc()/mem_calloc()/mem_realloc()/mem_free() macros declared
+ * in mem_watch.h.  Compiled with MEM_REDZONE these surround every
+ * block with canary bytes that are verified when the block is freed
+ * and by mem_check() (also run every MEM_CHECK_INTERVAL calls if set),
+ * and blocks selected with mem_guard_size() or mem_guard_site() are
+ * placed right before an inaccessible page so overruns fault at once.
+ * With MEM_QUARANTINE mem_free() does not release blocks right away
+ * but poisons them and keeps them in a bounded FIFO (see
+ * mem_quarantine()); a block written to after being freed is reported
+ * with its allocation and free sites when it leaves the FIFO, one
+ * freed again while in it as a double free and not released.
+ *
+ * Reports (mem_stats() and friends) are printed with MREPORT(), an
+ * alias for printf().  Diagnostics are logged by MPOOL_LOG() and MLOG()
+ * (see mem_log.c): every call site is limited to a few records a
+ * second with a count of those suppressed, and logging only copies the
+ * arguments into a buffer of the calling thread; a flusher formats
+ * them as text, JSON lines or binary records (mem_log_format()) and
+ * hands them to a sink, stdout unless mem_log_sink() says otherwise.
  *
  * The use of pre-allocated memory pool and a hash table to keep
  * track of allocated memory objects helps in making mem_watcher
@@ -118,30 +280,180 @@
  * helps.
  */
 
+#if defined (__linux__) && !defined (_GNU_SOURCE)
+# define _GNU_SOURCE		/* pthread_getattr_np(), dl_iterate_phdr() */
+#endif	/* __linux__ */
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
  
 #if defined (__OpenBSD__) || defined (__FreeBSD__) || defined (__NetBSD__)
 # include <sys/queue.h>
+# include <sys/tree.h>
 #endif	/* __OpenBSD__ || __FreeBSD__ || __NetBSD__ */
  
 #if defined (unix) || defined (__unix__)
 # include <sys/types.h>
+# include <sys/mman.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <signal.h>
+# include <time.h>
+# include <unistd.h>
+# include <sys/uio.h>
 #endif	/* unix || __unix__ */
 
 #if defined (_WIN32) || defined (_WINDOWS) || defined (linux)
 # include <bsd_list.h>
+# include <bsd_tree.h>
 #endif	/* _WIN32 || _WINDOWS || linux */
  
 #if defined (_WIN32) || defined (_WINDOWS)
 typedef unsigned long	u_long;
+typedef unsigned __int64 u_int64_t;
+# include <windows.h>
 #endif	/* _WIN32 || _WINDOWS */
 
+#if defined (__SSE2__)
+# include <emmintrin.h>
+#endif	/* __SSE2__ */
+
+/*
+ * The conservative leak scan (mem_leaks()) needs to find the stacks
+ * and data segments of the process, which is only done on Linux.
+ */
+#if defined (__linux__) && !defined (MEM_NO_SCAN)
+# define MEM_SCAN
+# include <setjmp.h>
+# include <link.h>
+#endif	/* __linux__ && !MEM_NO_SCAN */
+
+/*
+ * With MEM_THREADS all entry points are serialized by a (recursive)
+ * lock and the leak scan runs on up to MEM_SCAN_THREADS threads.
+ */
+#if defined (MEM_THREADS)
+# include <pthread.h>
+# define MEM_LOCK() do {						\
+	pthread_mutex_lock(&_mem_lock);					\
+	++_mem_lock_depth;						\
+	if (MEM_EXPECT(_mem_forked != 0, 0))				\
+		mem_fork_setup();					\
+	if (MEM_EXPECT((_mem_on & MEM_ON_SWITCH) != 0, 0))		\
+		mem_switch(_mem_on_sig);				\
+} while (0)
+# define MEM_UNLOCK() do {						\
+	pthread_mutex_unlock(&_mem_lock);				\
+	if (--_mem_lock_depth == 0 && MEM_EXPECT(_mem_tag_due != 0, 0))	\
+		mem_tag_fire();						\
+} while (0)
+# define MEM_FORKED()		(_mem_forked != 0)
+/* The report buffers, taken before the lock */
+# define MEM_RPT_LOCK()		pthread_mutex_lock(&_mem_rpt_use)
+# define MEM_RPT_UNLOCK()	pthread_mutex_unlock(&_mem_rpt_use)
+#else
+/* A fork() child must not write to the records file of its parent */
+# define MEM_LOCK() do {						\
+	++_mem_lock_depth;						\
+	if (MEM_EXPECT(_mem_pm != NULL, 0) && getpid() != _mem_pid)	\
+		mem_fork_reset();					\
+	if (MEM_EXPECT((_mem_on & MEM_ON_SWITCH) != 0, 0))		\
+		mem_switch(_mem_on_sig);				\
+} while (0)
+# define MEM_UNLOCK() do {						\
+	if (--_mem_lock_depth == 0 && MEM_EXPECT(_mem_tag_due != 0, 0))	\
+		mem_tag_fire();						\
+} while (0)
+# define MEM_FORKED()		(getpid() != _mem_pid)
+# define MEM_RPT_LOCK()
+# define MEM_RPT_UNLOCK()
+#endif	/* MEM_THREADS */
+
+/* Per thread state, plain globals without threads */
+#if defined (MEM_THREADS)
+# define MEM_TLS		__thread
+#else
+# define MEM_TLS
+#endif	/* MEM_THREADS */
+
+#if defined (__GNUC__)
+# define MEM_EXPECT(e, v)	__builtin_expect((e), (v))
+#else
+# define MEM_EXPECT(e, v)	(e)
+#endif	/* __GNUC__ */
+
+/*
+ * Tracking can be switched off at run time (mem_enable()), the entry
+ * points then test MEM_OFF() and go straight to the C library.  A
+ * pointer for which MEM_NOTOURS() holds lies outside the addresses of
+ * all blocks ever recorded and needs no lookup to be known untracked,
+ * neither does one the pointer filter has never seen (MEM_UNKNOWN()).
+ * A signal only sets MEM_ON_SWITCH in _mem_on, so the entry points
+ * go to the tracker, which makes the switch when it next takes the
+ * lock.
+ */
+#define MEM_ON_SWITCH		2
+#define MEM_OFF()		MEM_EXPECT(_mem_on == 0, 1)
+#define MEM_NOTOURS(p)		((u_long)(p) - _mem_lo >= _mem_span)
+
+/* `p' is known untracked without taking the lock */
+#define MEM_UNKNOWN(p)		(MEM_NOTOURS(p) || !mem_bloom_has(p))
+
+/*
+ * A pointer without a record that lies among the tracked blocks is
+ * only given to the C library if blocks were handed out without one
+ * (tracking off, pool exhausted) and tracked blocks are the library's
+ * own pointers.  Otherwise it is a block freed before, or redzoned and
+ * so not what malloc() returned, and is reported and left alone (see
+ * mem_stray()).  MEM_FOREIGN() holds for pointers that may be freed
+ * without taking the lock.
+ */
+#if defined (MEM_REDZONE)
+# define MEM_LOOSE()		0
+#else
+# define MEM_LOOSE()		(_mem_loose != 0)
+#endif	/* MEM_REDZONE */
+#define MEM_FOREIGN(p)		(MEM_NOTOURS(p) || \
+				 (MEM_LOOSE() && !mem_bloom_has(p)))
+
+/* Tracking off and no block of ours left: `p' is the C library's */
+#if defined (MEM_QUARANTINE)
+# define MEM_IDLE()		(MEM_LOOSE() && _mem_lcount == 0 && \
+				 _mem_qlen == 0)
+#else
+# define MEM_IDLE()		(MEM_LOOSE() && _mem_lcount == 0)
+#endif	/* MEM_QUARANTINE */
+#define MEM_OFF_FREE(p)		(MEM_OFF() && (MEM_NOTOURS(p) || MEM_IDLE()))
+
+/* Time an entry point now and then, see mem_self() */
+#if !defined (MEM_NO_SELF)
+# define MEM_SELF_START(t)						\
+	((t) = (++_mem_self_n & (MEM_SELF_SAMPLE - 1)) == 0 ? mem_cycles() : 0)
+# define MEM_SELF_END(path, t) do {					\
+	if ((t) != 0)							\
+		mem_self_add((path), mem_cycles() - (t));		\
+} while (0)
+#else
+# define MEM_SELF_START(t)	((t) = 0)
+# define MEM_SELF_END(path, t)	((void)(t))
+#endif	/* !MEM_NO_SELF */
+
+/*
+ * Diagnostics go through the buffered, rate limited sink of mem_log.c,
+ * reports are printed right away.
+ */
 #define POOL_NALLOC_PEEK
-#define MPOOL_LOG(a)		printf a
+#define MPOOL_LOG(a)		MLOG(a)
 #include <my_bitstring.h>
+#include <mem_log.h>
 #include <m_pool.h>
+#include <mem_watch.h>
+#include <mem_shm.h>
+#include <mem_pm.h>
 
-#define MLOG(a)			printf a
+#define MREPORT(a)		printf a
 
 #if !defined (HASH_SIZE)
 # define HASH_SIZE		1024
@@ -151,41 +463,627 @@ typedef unsigned long	u_long;
 # define MAX_MEMALLOC_POOL	20000
 #endif	/* MAX_MEMALLOC_POOL */
 
+/*
+ * Redzone mode (MEM_REDZONE): MEM_RZ_SIZE canary bytes of value
+ * MEM_RZ_BYTE are placed before and after each block handed out by the
+ * _mem_malloc() family.  MEM_RZ_SIZE should keep malloc() alignment.
+ * With MEM_CHECK_INTERVAL set every that many wrapper calls all live
+ * blocks are verified by mem_check().
+ */
+#if !defined (MEM_RZ_SIZE)
+# define MEM_RZ_SIZE		16
+#endif	/* MEM_RZ_SIZE */
+
+#if !defined (MEM_RZ_BYTE)
+# define MEM_RZ_BYTE		0xfd
+#endif	/* MEM_RZ_BYTE */
+
+#if !defined (MEM_CHECK_INTERVAL)
+# define MEM_CHECK_INTERVAL	0
+#endif	/* MEM_CHECK_INTERVAL */
+
+/*
+ * Quarantine (MEM_QUARANTINE): blocks released by _mem_free() are
+ * filled with MEM_QUAR_BYTE and held back until more than
+ * MEM_QUAR_FREES blocks or MEM_QUAR_BYTES bytes are waiting, then the
+ * oldest are verified and really freed.  mem_quarantine() lowers the
+ * limits at run time.
+ */
+#if !defined (MEM_QUAR_BYTE)
+# define MEM_QUAR_BYTE		0xdd
+#endif	/* MEM_QUAR_BYTE */
+
+#if !defined (MEM_QUAR_FREES)
+# define MEM_QUAR_FREES		4096
+#endif	/* MEM_QUAR_FREES */
+
+#if !defined (MEM_QUAR_BYTES)
+# define MEM_QUAR_BYTES		(16 * 1024 * 1024)
+#endif	/* MEM_QUAR_BYTES */
+
+/*
+ * Leak scan: at most MEM_SCAN_ROOTS extra root ranges can be
+ * registered, work is handed out in pieces of MEM_SCAN_CHUNK bytes.
+ */
+#if !defined (MEM_SCAN_ROOTS)
+# define MEM_SCAN_ROOTS		256
+#endif	/* MEM_SCAN_ROOTS */
+
+#if !defined (MEM_SCAN_CHUNK)
+# define MEM_SCAN_CHUNK		(256 * 1024)
+#endif	/* MEM_SCAN_CHUNK */
+
+#if !defined (MEM_SCAN_THREADS)
+# define MEM_SCAN_THREADS	8
+#endif	/* MEM_SCAN_THREADS */
+
+/*
+ * Arenas log their blocks in pieces of MEM_ARENA_LOG entries, pieces
+ * of ended arenas are kept for reuse.
+ */
+#if !defined (MEM_ARENA_LOG)
+# define MEM_ARENA_LOG		1022
+#endif	/* MEM_ARENA_LOG */
+
+/*
+ * Untracked pointer filter: a counting Bloom filter over the pointers
+ * in the hash, MEM_BLOOM_BITS 4-bit counters per pool record.  Each
+ * pointer sets MEM_BLOOM_K counters within one MEM_BLOOM_LINE bytes
+ * line so a lookup touches one cache line.  A counter that reaches 15
+ * stays there.  MEM_NO_BLOOM leaves the filter out.
+ */
+#if !defined (MEM_BLOOM_BITS)
+# define MEM_BLOOM_BITS		16
+#endif	/* MEM_BLOOM_BITS */
+
+#define MEM_BLOOM_K		4
+#define MEM_BLOOM_LINE		64
+#define MEM_BLOOM_MAX		15
+
+/*
+ * Counters each thread keeps to itself, the lookups the filter
+ * answers (counted without the lock) and the tag counters: up to
+ * MEM_THR_SLOTS threads get a slot of their own, read by whoever
+ * reports, slot 0 holds those of threads that exited and is shared by
+ * any beyond.
+ */
+#if !defined (MEM_THR_SLOTS)
+# define MEM_THR_SLOTS		64
+#endif	/* MEM_THR_SLOTS */
+
+/*
+ * mem_report() walks the record pool on up to MEM_REPORT_THREADS
+ * threads, MEM_REPORT_STEP records at a time, and formats into
+ * MEM_REPORT_BUF bytes set aside for it.  The threads other than the
+ * caller are started once and wait for the next report.
+ */
+#if !defined (MEM_REPORT_THREADS)
+# define MEM_REPORT_THREADS	8
+#endif	/* MEM_REPORT_THREADS */
+
+#if !defined (MEM_REPORT_BUF)
+# define MEM_REPORT_BUF		(64 * 1024)
+#endif	/* MEM_REPORT_BUF */
+
+#define MEM_REPORT_STEP		4096
+
+/*
+ * Generations started by mem_mark() keep live blocks and bytes by
+ * site, the last MEM_GENS of them (at least 2) separately; older ones
+ * are folded into the oldest kept.
+ */
+#if !defined (MEM_GENS)
+# define MEM_GENS		8
+#endif	/* MEM_GENS */
+
+/*
+ * mem_profile() streams through the same buffer, as stored deflate
+ * blocks of at most MEM_PF_BLOCK bytes after a 5 byte block header.
+ */
+#define MEM_PF_BLOCK							\
+	(MEM_REPORT_BUF - 5 < 65535 ? MEM_REPORT_BUF - 5 : 65535)
+
+/*
+ * Accounting tags: up to MEM_TAGS, tag 0 is for untagged blocks.
+ * Threads keep what they allocate and free per tag in their slot (see
+ * MEM_THR_SLOTS) and merge it into the totals once it reaches
+ * MEM_TAG_FLUSH bytes either way or when the thread exits; the slots
+ * of all threads are merged when the totals are asked for.
+ */
+#if !defined (MEM_TAGS)
+# define MEM_TAGS		64
+#endif	/* MEM_TAGS */
+
+#if !defined (MEM_TAG_FLUSH)
+# define MEM_TAG_FLUSH		(16 * 1024)
+#endif	/* MEM_TAG_FLUSH */
+
+/*
+ * Cost of the tracker itself: unless MEM_NO_SELF the entry points
+ * time one call in MEM_SELF_SAMPLE (a power of two), in CPU cycles
+ * where MEM_SELF_TSC, into per thread counters.  Up to
+ * MEM_SELF_THREADS threads get counters of their own, slot 0 holds
+ * those of threads that exited and is shared by any beyond.
+ */
+#if !defined (MEM_SELF_SAMPLE)
+# define MEM_SELF_SAMPLE	16
+#endif	/* MEM_SELF_SAMPLE */
+
+#if !defined (MEM_SELF_THREADS)
+# define MEM_SELF_THREADS	64
+#endif	/* MEM_SELF_THREADS */
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+# define MEM_SELF_TSC
+#endif	/* __GNUC__ && (__x86_64__ || __i386__) */
+
+/* Bytes set aside for site names in a MEM_WATCH_FILE file */
+#if !defined (MEM_PM_STRS)
+# define MEM_PM_STRS		(64 * 1024)
+#endif	/* MEM_PM_STRS */
+
+/* Guard page blocks end this close to the guard page */
+#define MEM_GUARD_ALIGN		sizeof(long)
+#define MEM_GUARD_RULES		16
+
+/*
+ * Callsite statistics: up to MEM_SITES distinct file:line:type
+ * triples get an id, counters and a histogram of the requested sizes
+ * by power of two (MEM_SIZE_CLASSES, see mem_watch.h).  Lifetimes of
+ * freed blocks go to log-linear histograms with MEM_LT_SUB buckets per
+ * power of two of clock ticks, longer lifetimes end up in the last
+ * bucket.
+ */
+#if !defined (MEM_SITES)
+# define MEM_SITES		1024
+#endif	/* MEM_SITES */
+
+/* mem_site_stats() lists this many sites, busiest first */
+#if !defined (MEM_SITE_TOP)
+# define MEM_SITE_TOP		32
+#endif	/* MEM_SITE_TOP */
+
+#define MEM_SITE_HASH		(2 * MEM_SITES)
+
+/* Site of a record */
+#define MEM_SITE(m)		(&_mem_site[(m)->mc_sid])
+
+/* Site id of a `type' call at `sd', looked up on first use */
+#define MEM_SD_ID(sd, type)						\
+	((sd)->sd_id[(type) - 1] != 0 ? (sd)->sd_id[(type) - 1] :	\
+	 ((sd)->sd_id[(type) - 1] = mem_site_id((sd)->sd_file,		\
+	 (sd)->sd_line, (type))))
+
+/* Descriptor for the file/line entry points */
+#define MEM_SD_INIT(sd, file, line, type)	do {			\
+	memset((sd), 0, sizeof(*(sd)));					\
+	(sd)->sd_file	= (file);					\
+	(sd)->sd_line	= (line);					\
+	(sd)->sd_type	= (type);					\
+} while (0)
+
+#define MEM_LT_SUBBITS		2
+#define MEM_LT_SUB		(1 << MEM_LT_SUBBITS)
+#define MEM_LT_BUCKETS		(48 * MEM_LT_SUB)
+
+/*
+ * Watermarks (mem_watermark()): after firing a live bytes or count
+ * watermark is raised to MEM_WM_REARM percent of the current value.
+ * While a growth watermark is set the triggers are evaluated at least
+ * every MEM_WM_POLL bytes allocated.
+ */
+#if !defined (MEM_WM_REARM)
+# define MEM_WM_REARM		150
+#endif	/* MEM_WM_REARM */
+
+#if !defined (MEM_WM_POLL)
+# define MEM_WM_POLL		(64 * 1024)
+#endif	/* MEM_WM_POLL */
+
+#define MEM_WM_BYTES		0x01	/* Reasons a snapshot is taken */
+#define MEM_WM_COUNT		0x02
+#define MEM_WM_GROWTH		0x04
+#define MEM_WM_USER		0x08
+#define MEM_WM_SIGNAL		0x10
+#define MEM_WM_TAGS		0x20	/* Not a snapshot, budget callbacks */
+
+/*
+ * Snapshots for mem_signal() are formatted ahead of time into one of
+ * two buffers of MEM_SIG_BUF bytes, the handler write()s the newer.
+ */
+#if !defined (MEM_SIG_BUF)
+# define MEM_SIG_BUF		8192
+#endif	/* MEM_SIG_BUF */
+
+/* Stamp records with the time stamp counter where there is one */
+#if defined (__GNUC__) && (defined (__i386__) || defined (__x86_64__))
+# define MEM_TSC
+#endif	/* __GNUC__ && (__i386__ || __x86_64__) */
+
 #define MEMHASH(x)		((x) % HASH_SIZE)
 
+#define MEM_TYPE_NAME(t)						\
+	((t) == MEM_TYPE_ALLOC ? "alloc" :				\
+	 (t) == MEM_TYPE_REALLOC ? "realloc" : "UNKNOWN")
+
 struct mem_chunk {
 	TAILQ_ENTRY(mem_chunk)
 		mc_link;
-	int	mc_type;
-#define MEM_TYPE_ALLOC		1
-#define MEM_TYPE_REALLOC	2
+	u_int	mc_sid;		/* Site id, see mem_site_id() */
+	int	mc_flags;
+#define MEM_FLAG_REDZONE	0x01	/* Block has canary redzones */
+#define MEM_FLAG_GUARD		0x02	/* Block is followed by guard page */
 	int	mc_size;
-	int	mc_line;
-	const	char *mc_file;
 	void	*mc_p;
+	RB_ENTRY(mem_chunk)
+		mc_node;	/* Address index */
+	int	mc_tree;
+#define MEM_TREE_INDEXED	0x01	/* Record is in _mem_tree */
+#define MEM_TREE_DUP		0x02	/* Other records have the same mc_p */
+	int	mc_tag;		/* Accounting tag, see mem_tag() */
+	u_long	mc_seq;		/* Value of _mem_seq when recorded */
+	u_int64_t mc_stamp;	/* mem_clock() when recorded */
 };
 TAILQ_HEAD(chunk_bucket_t, mem_chunk);
+RB_HEAD(chunk_tree_t, mem_chunk);
+
+struct mem_quar {
+	void	*mq_p;
+	int	mq_size;
+	int	mq_flags;	/* mc_flags of the block */
+	u_int	mq_asid;	/* Where it was allocated */
+	u_int	mq_fsid;	/* and freed */
+};
+
+/* Memory range to scan for pointers */
+struct mem_range {
+	u_long	mr_lo;
+	u_long	mr_hi;
+};
+
+struct mem_guard {
+	size_t	mg_lo;		/* Size range, when mg_file is NULL */
+	size_t	mg_hi;
+	const	char *mg_file;	/* Callsite, line 0 matches whole file */
+	int	mg_line;
+};
+
+/* Live memory of a site, for snapshots */
+struct mem_top {
+	const	char *mt_file;
+	int	mt_line;
+	u_long	mt_count;
+	u_long	mt_bytes;
+	double	mt_rate;
+};
+
+/* Piece of an arena's block log, newest first */
+struct mem_arena_log {
+	struct	mem_arena_log *al_next;
+	int	al_n;		/* Entries used */
+	struct {
+		void	*ab_p;
+		size_t	ab_size;
+	} al_blk[MEM_ARENA_LOG];
+};
+
+struct mem_arena {
+	LIST_ENTRY(mem_arena)
+		ma_link;	/* On _mem_arenas or the free list */
+	const	char *ma_name;
+	u_int	ma_sid;		/* Where it was begun */
+	u_long	ma_nblocks;
+	u_long	ma_bytes;
+	struct	mem_arena_log *ma_log;	/* Current piece */
+	struct	mem_arena_log *ma_first;	/* Oldest piece */
+};
+
+LIST_HEAD(arena_list_t, mem_arena);
+
+struct mem_tag {
+	const	char *mt_name;	/* NULL if id unused */
+	long	mt_bytes;	/* Live bytes and blocks, as merged */
+	long	mt_count;
+	long	mt_peak;
+	size_t	mt_budget;	/* 0 if none */
+	void	(*mt_cb)(int,long,void *);
+	void	*mt_arg;
+	int	mt_over;	/* Above budget */
+	int	mt_fire;	/* mt_cb is to be called */
+	u_long	mt_nover;	/* Times the budget was crossed */
+};
+
+/* Live set by site as seen by one mem_report() worker */
+struct mem_rpt {
+	u_long	rp_count[MEM_SITES];
+	u_long	rp_bytes[MEM_SITES];
+	u_int64_t rp_oldest[MEM_SITES];	/* Earliest mc_stamp */
+	u_long	rp_nold;		/* Records of an earlier epoch */
+};
+
+/* Live memory by site of the blocks recorded since a mem_mark() */
+struct mem_gen {
+	u_long	gn_id;		/* As returned by mem_mark() */
+	u_long	gn_seq;		/* First _mem_seq of the generation */
+	u_long	gn_count[MEM_SITES];
+	u_long	gn_bytes[MEM_SITES];
+};
+
+/* What the entry points of one thread cost, see mem_self() */
+struct mem_cost {
+	int	co_used;	/* Slot taken by a thread */
+	u_long	co_calls[MEM_SELF_PATHS];	/* Timed */
+	u_int64_t co_time[MEM_SELF_PATHS];
+	u_int64_t co_max[MEM_SELF_PATHS];
+	u_long	co_hist[MEM_SELF_PATHS][MEM_SIZE_CLASSES];
+};
+
+/* Counters of one thread, see MEM_THR_SLOTS */
+struct mem_thr {
+	int	th_used;	/* Slot taken by a thread */
+	u_long	th_nrej;	/* Lookups answered by the filter */
+	long	th_tag_db[MEM_TAGS];	/* Not yet merged bytes, */
+	long	th_tag_dc[MEM_TAGS];	/* blocks, by tag */
+};
+
+/* A mem_profile() being written */
+struct mem_pf {
+	int	pf_fd;
+	int	pf_err;		/* A write failed */
+	size_t	pf_off;		/* Bytes in the current block */
+	u_int	pf_crc;		/* CRC-32 of the profile so far */
+	u_int	pf_isize;	/* and its length, mod 2^32 */
+	u_int64_t pf_nstr;	/* Strings in the string table */
+};
+
+struct mem_site {
+	const	char *ms_file;	/* NULL if id unused */
+	int	ms_line;
+	int	ms_type;	/* MEM_TYPE_* */
+	u_long	ms_nalloc;	/* Blocks recorded from here */
+	u_long	ms_bytes;	/* and their total size */
+	u_long	ms_nfree;
+	u_long	ms_fbytes;	/* Bytes of the freed ones */
+	u_long	ms_sizes[MEM_SIZE_CLASSES];
+	u_int	ms_life[MEM_LT_BUCKETS];	/* Lifetimes of freed ones */
+};
 
 int	_mem_init = 0;
 struct	mpool *_mem_pool;
 struct	chunk_bucket_t _mem_hash[HASH_SIZE];
+struct	chunk_tree_t _mem_tree;
+u_long	_mem_seq = 0;		/* Records made so far */
+struct	mem_guard _mem_guard[MEM_GUARD_RULES];
+int	_mem_nguard = 0;
+int	_mem_ncheck = 0;
+#if defined (MEM_QUARANTINE)
+struct	mem_quar _mem_quar[MEM_QUAR_FREES];
+int	_mem_qhead = 0;		/* Oldest quarantined block */
+int	_mem_qlen = 0;
+size_t	_mem_qbytes = 0;	/* Footprint of quarantined blocks */
+int	_mem_qmaxfrees = MEM_QUAR_FREES;
+size_t	_mem_qmaxbytes = MEM_QUAR_BYTES;
+#endif	/* MEM_QUARANTINE */
+struct	mem_range _mem_roots[MEM_SCAN_ROOTS];
+int	_mem_nroots = 0;
+struct	mem_site _mem_site[MEM_SITES];	/* By id, 0 is unknown */
+u_int	_mem_site_hash[MEM_SITE_HASH];	/* Ids by file:line:type */
+u_int	_mem_nsites = 1;	/* Ids handed out */
+u_int	_mem_site_spare = 0;	/* Id taken but not used, or 0 */
+u_long	_mem_nsitelost = 0;	/* Records without a site id */
+int	_mem_nsitedesc = 0;	/* Descriptors found by mem_init() */
+struct	arena_list_t _mem_arenas;	/* Arenas not ended yet */
+struct	arena_list_t _mem_arena_free;
+struct	mem_arena_log *_mem_arena_logs = NULL;	/* Free log pieces */
+u_long	_mem_arena_nbegun = 0;
 
-void	mem_stats(void);
-void	mem_alloc_notify(void *,size_t,const char *,int);
-void	mem_realloc_notify(void *,size_t,const char *,int);
-void	mem_free_notify(void *,const char *,int);
-void	mem_deinit(void);
-void	mem_init(void);
-void	mpool_stats(void);
+#if defined (__ELF__)
+/* Bounds of the "mem_sites" section, see mem_watch.h */
+extern	struct mem_sitedesc __start_mem_sites[] __attribute__((__weak__));
+extern	struct mem_sitedesc __stop_mem_sites[] __attribute__((__weak__));
+#endif	/* __ELF__ */
+u_int64_t _mem_tick0;		/* mem_clock() and mem_nsec() at init */
+u_int64_t _mem_nsec0;
+u_long	_mem_lbytes = 0;	/* Live bytes and blocks */
+u_long	_mem_lcount = 0;
+long	_mem_wm_credit = LONG_MAX;	/* Bytes until triggers are checked */
+u_long	_mem_wm_bytes = 0;	/* Watermarks, 0 if not set */
+u_long	_mem_wm_count = 0;
+u_long	_mem_wm_growth = 0;	/* Bytes per _mem_wm_ival ns */
+u_int64_t _mem_wm_ival;
+u_int64_t _mem_wm_t0;		/* Start of growth interval */
+u_long	_mem_wm_b0;		/* and live bytes then */
+int	_mem_wm_nsnap = 0;	/* Snapshots taken */
+char	*_mem_wm_prefix = NULL;	/* Snapshot files, stdout if NULL */
+struct	mem_shm *_mem_shm = NULL;	/* Exported counters */
+struct	mem_pm_hdr *_mem_pm = NULL;	/* MEM_WATCH_FILE mapping */
+struct	mem_tag _mem_tag[MEM_TAGS];	/* By id, 0 is untagged */
+int	_mem_ntags = 1;
+MEM_TLS	int _mem_tag_cur;	/* Tag of the blocks allocated now */
+int	_mem_tag_due = 0;	/* Budget callbacks wait for the unlock */
+MEM_TLS	int _mem_lock_depth;	/* MEM_LOCK()s held by this thread */
+struct	mem_thr _mem_thr[MEM_THR_SLOTS];	/* 0 is shared */
+MEM_TLS	struct mem_thr *_mem_thr_cur;	/* Slot of this thread */
+size_t	_mem_pm_len;
+char	_mem_pm_path[1024];	/* MEM_WATCH_FILE, for fork() children */
+struct	mem_cost _mem_cost[MEM_SELF_THREADS];	/* 0 is shared */
+MEM_TLS	struct mem_cost *_mem_cost_cur;	/* Slot of this thread */
+MEM_TLS	u_int _mem_self_n;	/* Entry points called, for sampling */
+u_long	_mem_nlookup = 0;	/* Hash lookups */
+u_long	_mem_nprobe = 0;	/* and the chain steps they took */
+u_long	_mem_maxprobe = 0;
+u_long	_mem_probe_hist[MEM_SIZE_CLASSES];
+u_int64_t _mem_shm_ival;	/* Update interval, ns */
+u_int64_t _mem_shm_t0;		/* Last update */
+char	_mem_sig_buf[2][MEM_SIG_BUF];	/* Signal snapshots */
+size_t	_mem_sig_len[2];
+volatile sig_atomic_t _mem_sig_cur = 0;	/* Buffer to write */
+int	_mem_sig_fd = -1;
+u_int64_t _mem_sig_ival = 0;	/* Refresh interval, ns, 0 if off */
+u_int64_t _mem_sig_t0;		/* Last refresh */
+pid_t	_mem_pid;		/* Detects a fork() child */
+volatile sig_atomic_t _mem_on = 0;	/* Tracking switched on */
+volatile sig_atomic_t _mem_on_sig;	/* and as the signal wants it */
+u_long	_mem_lo = 0;		/* Addresses of all records so far, */
+u_long	_mem_span = 0;		/* see MEM_NOTOURS() */
+int	_mem_nepoch = 0;	/* Times switched on after mem_init() */
+u_long	_mem_epoch_seq = 0;	/* _mem_seq when last switched on */
+u_long	_mem_nuntracked = 0;	/* Frees of blocks allocated while off */
+u_long	_mem_nkept = 0;		/* of those, left allocated */
+int	_mem_loose = 0;		/* Blocks handed out without a record */
+u_char	*_mem_bloom = NULL;	/* Untracked pointer filter */
+u_long	_mem_bloom_mask;	/* Lines - 1 */
+u_long	_mem_bloom_n = 0;	/* Pointers in the filter */
+u_long	_mem_bloom_nsat = 0;	/* Counters stuck at MEM_BLOOM_MAX */
+u_long	_mem_bloom_nrej = 0;	/* Lookups answered by the filter */
+u_long	_mem_bloom_nfp = 0;	/* Passed the filter, not in the hash */
+struct	mem_rpt _mem_rpt[MEM_REPORT_THREADS];	/* mem_report() partials */
+int	_mem_rpt_next;		/* Next record to hand out */
+int	_mem_rpt_id[MEM_SITES];	/* Sites in report order */
+char	_mem_rpt_hdr[512];
+char	_mem_rpt_buf[MEM_REPORT_BUF];
+u_int	_mem_crc_tab[256];	/* For mem_profile(), made on first use */
+struct	mem_gen _mem_gen[MEM_GENS];	/* By id % MEM_GENS */
+u_long	_mem_gen_id = 0;	/* Newest generation, 0 before mem_mark() */
+#if defined (MEM_THREADS)
+pthread_mutex_t _mem_lock;
+pthread_cond_t _mem_wm_cv;	/* Wakes the reporter thread */
+volatile sig_atomic_t _mem_forked = 0;	/* fork() child not set up yet */
+# if defined (PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP)
+const	pthread_mutex_t _mem_lock0 = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+const	pthread_mutex_t _mem_mutex0 = PTHREAD_MUTEX_INITIALIZER;
+const	pthread_cond_t _mem_cond0 = PTHREAD_COND_INITIALIZER;
+# endif	/* PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP */
+int	_mem_wm_pending = 0;	/* Reasons of snapshots to take */
+int	_mem_reporter = 0;	/* Reporter thread running */
+# if defined (MEM_SCAN)
+pthread_key_t _mem_tkey;	/* Unregisters thread stacks at exit */
+__thread int _mem_tstack;	/* Stack of this thread registered */
+# endif	/* MEM_SCAN */
+pthread_key_t _mem_thr_key;	/* Gives the slot back at exit */
+pthread_mutex_t _mem_rpt_use;	/* One report at a time */
+pthread_mutex_t _mem_rpt_lock;	/* mem_report() workers, */
+pthread_cond_t _mem_rpt_cv;	/* wakes them */
+pthread_cond_t _mem_rpt_done;	/* wakes mem_report() */
+int	_mem_rpt_started = 0;	/* Workers started, or tried */
+int	_mem_rpt_nthr = 0;	/* and how many run */
+int	_mem_rpt_want = 0;	/* Partial tables not yet taken, */
+int	_mem_rpt_busy = 0;	/* not yet done */
+int	_mem_rpt_claim;		/* Next table to take */
+#endif	/* MEM_THREADS */
+
+static	struct mem_chunk *mem_chunk_get(void *,const char *,
+	    struct mem_sitedesc *,int);
+static	u_int mem_site_alias(const char *,int,int);
+static	u_int mem_site_id(const char *,int,int);
+static	void *mem_alloc(size_t,struct mem_sitedesc *,int);
+static	void mem_dealloc(void *,size_t,struct mem_sitedesc *);
+static	struct mem_arena_log *mem_arena_log(struct mem_arena *);
+static	void mem_arena_report(void);
+static	void mem_epoch_report(int);
+static	size_t mem_snap_format(char *,size_t,int,int);
+static	void mem_publish(void);
+static	void mem_untracked(void *,const char *,struct mem_sitedesc *);
+static	int mem_stray(void *,const char *,struct mem_sitedesc *);
+static	void mem_bloom_init(void);
+static	void mem_bloom_update(void *,int);
+static	int mem_bloom_has(void *);
+static	void mem_bloom_reject(void);
+static	void mem_bloom_stats(void);
+static	void *mem_rpt_worker(void *);
+static	void mem_rpt_part(int *,int,int,u_long *,int *,int *);
+static	void mem_rpt_select(int *,int,int,int,u_long *);
+static	void mem_rpt_sort(int *,int,int,u_long *);
+static	struct mem_gen *mem_gen_find(u_long);
+static	int mem_write(int,const void *,size_t);
+static	int mem_writev(int,struct iovec *,int);
+static	u_int mem_crc32(u_int,const u_char *,size_t);
+static	u_char *mem_pb_varint(u_char *,u_int64_t);
+static	u_char *mem_pb_uint(u_char *,int,u_int64_t);
+static	u_char *mem_pb_bytes(u_char *,int,const void *,size_t);
+static	void mem_pf_flush(struct mem_pf *,int);
+static	void mem_switch(int);
+static	void mem_toggle_handler(int);
+static	void mem_sig_refresh(void);
+static	void mem_sig_handler(int);
+static	void mem_fork_reset(void);
+static	int mem_pm_open(const char *);
+static	void mem_pm_site(u_int,const char *,int,int);
+static	void mem_pm_detach(void);
+static	void mem_tag_add(int,long,long);
+static	void mem_tag_merge(int,struct mem_thr *);
+static	struct mem_thr *mem_thr_slot(void);
+static	void mem_tag_fire(void);
+static	void mem_tag_report(void);
+static	int mem_sz_class(u_long);
+#if !defined (MEM_NO_SELF)
+static	u_int64_t mem_cycles(void);
+static	struct mem_cost *mem_self_slot(void);
+static	void mem_self_add(int,u_int64_t);
+#endif	/* !MEM_NO_SELF */
+#if defined (MEM_THREADS)
+static	void mem_self_exit(void);
+#endif	/* MEM_THREADS */
+static	u_long mem_resident(const void *,size_t);
+static	u_long mem_self_pct(u_long *,double);
+static	void mem_self_report(void);
+#if defined (MEM_THREADS)
+static	void mem_lock_init(void);
+static	void mem_reporter_start(void);
+static	void *mem_rpt_thread(void *);
+static	void mem_rpt_start(void);
+static	void mem_thr_exit(void *);
+static	void mem_fork_prepare(void);
+static	void mem_fork_parent(void);
+static	void mem_fork_child(void);
+static	void mem_fork_setup(void);
+#endif	/* MEM_THREADS */
+static	void mem_chunk_link(struct mem_chunk *);
+static	struct mem_chunk *mem_chunk_unlink(void *);
+static	int mem_chunk_cmp(struct mem_chunk *,struct mem_chunk *);
+static	struct mem_chunk *mem_chunk_below(u_long);
+static	u_int64_t mem_nsec(void);
+static	u_int64_t mem_clock(void);
+static	void mem_site_alloc(struct mem_chunk *);
+static	void mem_site_free(struct mem_chunk *);
+static	void mem_wm_check(void);
+static	void mem_wm_snapshot(int);
+static	void mem_shm_publish(void);
+#if defined (MEM_REDZONE)
+static	int mem_rz_check(struct mem_chunk *,const char *,const char *,int);
+#endif	/* MEM_REDZONE */
+#if defined (MEM_SCAN) && defined (MEM_THREADS)
+static	void mem_thread_stack(void);
+static	void mem_thread_exit(void *);
+#endif	/* MEM_SCAN && MEM_THREADS */
 
 void
 mem_init()
 {
+#if defined (__ELF__)
+	struct mem_sitedesc *sd;
+#endif	/* __ELF__ */
+	char *env;
 	int i;
 
+	mem_log_init();
 	MLOG(("Memory watchdog initializing ...\n"));
 
-	if (mpool_init(&_mem_pool, "watchdog_mem",
+#if defined (MEM_THREADS)
+	mem_lock_init();
+	pthread_atfork(mem_fork_prepare, mem_fork_parent, mem_fork_child);
+	pthread_key_create(&_mem_thr_key, mem_thr_exit);
+# if defined (MEM_SCAN)
+	pthread_key_create(&_mem_tkey, mem_thread_exit);
+# endif	/* MEM_SCAN */
+#endif	/* MEM_THREADS */
+
+	/* MEM_WATCH_FILE keeps the records in a file that outlives us */
+	if ((env = getenv("MEM_WATCH_FILE")) != NULL && *env != '\0' &&
+	    mem_pm_open(env) < 0)
+		MLOG(("mem_init: cannot map %s, records kept in memory\n",
+		    env));
+	if (_mem_pm == NULL && mpool_init(&_mem_pool, "watchdog_mem",
 	    MAX_MEMALLOC_POOL, sizeof(struct mem_chunk)) < 0) {
 		MLOG(("mem_init: failed to init memory pool\n"));
 		return;
@@ -193,166 +1091,4838 @@ mem_init()
 	for (i = 0; i < HASH_SIZE; i++) {
 		TAILQ_INIT(&_mem_hash[i]);
 	}
+	RB_INIT(&_mem_tree);
+	mem_bloom_init();
+	LIST_INIT(&_mem_arenas);
+	LIST_INIT(&_mem_arena_free);
+	_mem_site[0].ms_file = "(unknown)";
+	_mem_tag[0].mt_name = "(untagged)";
+	_mem_pid = getpid();
+#if defined (__ELF__)
+	/* Number the sites of the mem_*() macros before any call */
+	for (sd = __start_mem_sites; sd < __stop_mem_sites; sd++) {
+		(void)MEM_SD_ID(sd, sd->sd_type);
+		++_mem_nsitedesc;
+	}
+#endif	/* __ELF__ */
+	_mem_tick0 = mem_clock();
+	_mem_nsec0 = mem_nsec();
 	++_mem_init;
+
+	/* MEM_WATCH=0 ships tracking off, MEM_WATCH_SIGNAL toggles it */
+	if ((env = getenv("MEM_WATCH")) == NULL ||
+	    (strcmp(env, "0") != 0 && strcmp(env, "off") != 0))
+		_mem_on = 1;
+	else
+		_mem_loose = 1;
+	if ((env = getenv("MEM_WATCH_SIGNAL")) != NULL && atoi(env) > 0)
+		mem_toggle_signal(atoi(env));
 	return;
 }
 
 void
 mem_deinit()
 {
+	char name[64];
 
+	MEM_LOCK();
+	/* A fork() child that never called us still shares the file */
+	if (_mem_pm != NULL && !MEM_FORKED())
+		_mem_pm->ph_state = MEM_PM_EXITED;
+	if (_mem_shm != NULL) {
+		snprintf(name, sizeof(name), MEM_SHM_NAME, (int)getpid());
+		shm_unlink(name);
+		munmap(_mem_shm, sizeof(*_mem_shm));
+		_mem_shm = NULL;
+	}
+	MEM_UNLOCK();
+#if defined (MEM_REDZONE)
+	mem_check();
+#endif	/* MEM_REDZONE */
 	mem_stats();
+#if defined (MEM_SCAN)
+	mem_leaks();
+#endif	/* MEM_SCAN */
+	return;
 }
 
 /*
- * External routines.
+ * Internal routines.
  */
 
-void
-mem_alloc_notify(ptr, size, file, line)
+/*
+ * Get a cleared record of a `type' block allocated at `sd' from the
+ * pool, `fn' names the caller for the pool exhaustion message.
+ */
+static struct mem_chunk *
+mem_chunk_get(ptr, fn, sd, type)
 	void	*ptr;
-	size_t	size;
-	const	char *file;
-	int	line;
+	const	char *fn;
+	struct	mem_sitedesc *sd;
+	int	type;
 {
-	int hash;
 	struct mem_chunk *m;
-	struct chunk_bucket_t *bkt;
-
-	/* Don't even bother */
-	if (_mem_init == 0)
-		return;
 
+#if defined (MEM_SCAN) && defined (MEM_THREADS)
+	if (_mem_tstack == 0)
+		mem_thread_stack();
+#endif	/* MEM_SCAN && MEM_THREADS */
 	mpool_cget(_mem_pool, m);
 	if (m == NULL) {
-		MLOG(("mem_alloc_notify: (%s:%d): 0x%lx: memory pool "
-		    "exauhsted!\n", file, line, (u_long)ptr));
-		mpool_stats();
-		return;
+		_mem_loose = 1;
+		MLOG(("%s: (%s:%d): 0x%lx: memory pool exauhsted!\n",
+		    fn, sd->sd_file, sd->sd_line, (u_long)ptr));
+		/* Once, not for every record we fail to get */
+		if (_mem_pool->mp_afail == 1)
+			mpool_stats();
+		return (NULL);
 	}
-	m->mc_line	= line;
-	m->mc_file	= file;
+	m->mc_sid	= MEM_SD_ID(sd, type);
 	m->mc_p		= ptr;
-	m->mc_type	= MEM_TYPE_ALLOC;
-	m->mc_size	= size;
-	hash = MEMHASH((u_long)ptr);
-	bkt = &_mem_hash[hash];
-	if (TAILQ_FIRST(bkt) == NULL)
-		TAILQ_INSERT_HEAD(bkt, m, mc_link);
-	else
-		TAILQ_INSERT_TAIL(bkt, m, mc_link);
+	m->mc_seq	= _mem_seq++;
+	m->mc_tag	= _mem_tag_cur;
+	return (m);
+}
+
+RB_GENERATE_STATIC(chunk_tree_t, mem_chunk, mc_node, mem_chunk_cmp)
+
+static int
+mem_chunk_cmp(a, b)
+	struct	mem_chunk *a;
+	struct	mem_chunk *b;
+{
+
+	return ((u_long)a->mc_p < (u_long)b->mc_p ? -1 :
+	    (u_long)a->mc_p > (u_long)b->mc_p);
+}
+
+/*
+ * The indexed record with the highest address not above `addr', NULL
+ * if none.
+ */
+static struct mem_chunk *
+mem_chunk_below(addr)
+	u_long	addr;
+{
+	struct mem_chunk *m, *below;
+
+	below = NULL;
+	m = RB_ROOT(&_mem_tree);
+	while (m != NULL) {
+		if ((u_long)m->mc_p <= addr) {
+			below = m;
+			m = RB_RIGHT(m, mc_node);
+		} else
+			m = RB_LEFT(m, mc_node);
+	}
+	return (below);
+}
+
+static void
+mem_bloom_init()
+{
+#if !defined (MEM_NO_BLOOM)
+	u_long lines, want;
+	void *p;
+
+	want = (u_long)MAX_MEMALLOC_POOL * MEM_BLOOM_BITS /
+	    (MEM_BLOOM_LINE * 2);
+	for (lines = 1; lines < want; lines <<= 1)
+		;
+	if (posix_memalign(&p, MEM_BLOOM_LINE, lines * MEM_BLOOM_LINE) != 0) {
+		MLOG(("mem_init: no memory for the pointer filter\n"));
+		return;
+	}
+	memset(p, 0, lines * MEM_BLOOM_LINE);
+	_mem_bloom_mask = lines - 1;
+	_mem_bloom = p;
+#endif	/* !MEM_NO_BLOOM */
 	return;
 }
 
-void
-mem_realloc_notify(ptr, size, file, line)
+/*
+ * Line of `ptr' in the filter, the MEM_BLOOM_K counter numbers are
+ * left in `c'.
+ */
+static __inline u_char *
+mem_bloom_line(ptr, c)
 	void	*ptr;
-	size_t	size;
-	const	char *file;
-	int	line;
+	u_int	*c;
 {
-	int hash;
-	struct mem_chunk *m;
-	struct chunk_bucket_t *bkt;
+	u_int64_t h;
+	int i;
 
-	if (_mem_init == 0)
-		return;
+	h = (u_long)ptr;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	for (i = 0; i < MEM_BLOOM_K; i++)
+		c[i] = (h >> (64 - 7 * (i + 1))) & (MEM_BLOOM_LINE * 2 - 1);
+	return (_mem_bloom + (h & _mem_bloom_mask) * MEM_BLOOM_LINE);
+}
 
-	mpool_cget(_mem_pool, m);
-	if (m == NULL) {
-		MLOG(("mem_realloc_notify: (%s:%d): 0x%lx: memory pool "
-		    "exauhsted!\n", file, line, (u_long)ptr));
-		mpool_stats();
+/* Count `ptr' in (`delta' 1) or out (-1) of the filter, lock held */
+static void
+mem_bloom_update(ptr, delta)
+	void	*ptr;
+	int	delta;
+{
+	u_char *line, *b;
+	u_int c[MEM_BLOOM_K], v, sh;
+	int i;
+
+	if (_mem_bloom == NULL)
 		return;
+	line = mem_bloom_line(ptr, c);
+	for (i = 0; i < MEM_BLOOM_K; i++) {
+		b = &line[c[i] >> 1];
+		sh = (c[i] & 1) << 2;
+		v = (*b >> sh) & 0xf;
+		if (v == MEM_BLOOM_MAX)
+			continue;
+		v += delta;
+		if (v == MEM_BLOOM_MAX)
+			++_mem_bloom_nsat;
+		*b = (*b & ~(0xf << sh)) | (v << sh);
 	}
-	m->mc_line	= line;
-	m->mc_file	= file;
-	m->mc_p		= ptr;
-	m->mc_type	= MEM_TYPE_REALLOC;
-	m->mc_size	= size;
-	hash = MEMHASH((u_long)ptr);
-	bkt = &_mem_hash[hash];
+	_mem_bloom_n += delta;
+	return;
+}
+
+/*
+ * Zero if `ptr' is certainly not in the hash.  Read without the lock:
+ * counters of a pointer in the hash are not zero before its record is
+ * linked and after it is unlinked, anything else only costs a lookup.
+ */
+static int
+mem_bloom_has(ptr)
+	void	*ptr;
+{
+	u_char *line;
+	u_int c[MEM_BLOOM_K];
+	int i;
+
+	if (_mem_bloom == NULL)
+		return (1);
+	line = mem_bloom_line(ptr, c);
+	for (i = 0; i < MEM_BLOOM_K; i++)
+		if (((line[c[i] >> 1] >> ((c[i] & 1) << 2)) & 0xf) == 0) {
+			mem_bloom_reject();
+			return (0);
+		}
+	return (1);
+}
+
+/* Count a lookup the filter answered, without the lock */
+static void
+mem_bloom_reject()
+{
+#if defined (MEM_THREADS)
+	struct mem_thr *th;
+
+	if ((th = _mem_thr_cur) == NULL)
+		th = mem_thr_slot();
+	if (th != &_mem_thr[0])
+		++th->th_nrej;
+	else
+		__sync_fetch_and_add(&th->th_nrej, 1);
+#else
+	++_mem_bloom_nrej;
+#endif	/* MEM_THREADS */
+	return;
+}
+
+static void
+mem_chunk_link(m)
+	struct	mem_chunk *m;
+{
+	struct chunk_bucket_t *bkt;
+	struct mem_chunk *dup;
+	u_long p;
+
+	/* Grow the span first, a racing MEM_NOTOURS() sees a superset */
+	p = (u_long)m->mc_p;
+	if (_mem_span == 0) {
+		_mem_span = 1;
+		_mem_lo = p;
+	} else if (p < _mem_lo) {
+		_mem_span += _mem_lo - p;
+		_mem_lo = p;
+	} else if (p - _mem_lo >= _mem_span)
+		_mem_span = p - _mem_lo + 1;
+	mem_bloom_update(m->mc_p, 1);
+
+	bkt = &_mem_hash[MEMHASH((u_long)m->mc_p)];
 	if (TAILQ_FIRST(bkt) == NULL)
 		TAILQ_INSERT_HEAD(bkt, m, mc_link);
 	else
 		TAILQ_INSERT_TAIL(bkt, m, mc_link);
+	/*
+	 * A pointer notified twice keeps only its first record in the
+	 * address index.
+	 */
+	if ((dup = RB_INSERT(chunk_tree_t, &_mem_tree, m)) != NULL) {
+		dup->mc_tree |= MEM_TREE_DUP;
+		m->mc_tree = 0;
+	} else
+		m->mc_tree = MEM_TREE_INDEXED;
 	return;
 }
-void
-mem_free_notify(ptr, file, line)
+
+/*
+ * Remove the record of `ptr' from the hash, the caller reclaims it.
+ */
+static struct mem_chunk *
+mem_chunk_unlink(ptr)
 	void	*ptr;
-	const	char *file;
-	int	line;
 {
-	int hash;
-	struct mem_chunk *m;
+	struct mem_chunk *m, *dup;
 	struct chunk_bucket_t *bkt;
+	u_long n;
 
-	if (_mem_init == 0)
-		return;
-
-	m = NULL;
-	hash = MEMHASH((u_long)ptr);
-	bkt = &_mem_hash[hash];
+	bkt = &_mem_hash[MEMHASH((u_long)ptr)];
+	n = 0;
 	TAILQ_FOREACH(m, bkt, mc_link) {
+		++n;
 		if (m->mc_p == ptr) {
+			TAILQ_REMOVE(bkt, m, mc_link);
 			break;
 		}
 	}
+	++_mem_nlookup;
+	_mem_nprobe += n;
+	if (n > _mem_maxprobe)
+		_mem_maxprobe = n;
+	++_mem_probe_hist[mem_sz_class(n)];
 	if (m == NULL) {
-		MLOG(("mem_free_notify: (%s:%d): 0x%lx: pointer not in hash\n",
-		    file, line, (u_long)ptr));
-		return;
+		if (_mem_bloom != NULL)
+			++_mem_bloom_nfp;
+		return (NULL);
 	}
-	TAILQ_REMOVE(bkt, m, mc_link);
-	mpool_reclaim(_mem_pool, m);
-	return;
+	mem_bloom_update(ptr, -1);
+	if ((m->mc_tree & MEM_TREE_INDEXED) == 0)
+		return (m);
+	RB_REMOVE(chunk_tree_t, &_mem_tree, m);
+	if ((m->mc_tree & MEM_TREE_DUP) != 0) {
+		/* Index the next record of the same pointer instead */
+		TAILQ_FOREACH(dup, bkt, mc_link) {
+			if (dup->mc_p == ptr) {
+				RB_INSERT(chunk_tree_t, &_mem_tree, dup);
+				dup->mc_tree = MEM_TREE_INDEXED | MEM_TREE_DUP;
+				break;
+			}
+		}
+	}
+	m->mc_tree = 0;
+	return (m);
 }
 
-void
-mpool_stats()
+#if defined (MEM_REDZONE) || defined (MEM_QUARANTINE)
+
+/*
+ * Return offset of first byte in `p' that is not `c', -1 if all `n'
+ * bytes match.
+ */
+static long
+mem_chkfill(p, c, n)
+	const	u_char *p;
+	int	c;
+	size_t	n;
 {
+	size_t i;
+#if defined (__SSE2__)
+	__m128i pat, v;
+	int mask;
 
-	MLOG(("%s: obj_siz=%d, max_objs=%d, bmap_siz=%d\n",
-	    _mem_pool->mp_label, _mem_pool->mp_rsiz, _mem_pool->mp_nobjs,
-	    _mem_pool->mp_bmapsz));
-	MLOG(("max_bytes=%d, alloc_peek=%d\n", _mem_pool->mp_maxbytes,
-	    _mem_pool->mp_napeek));
-	MLOG(("%s: allocated %d, alloc_req %d, alloc_fail %d\n",
-	    _mem_pool->mp_label, _mem_pool->mp_nalloc, _mem_pool->mp_areq,
-	    _mem_pool->mp_afail));
-	MLOG(("%s: reclaim_req %d, reclaim_fail %d\n",
-	    _mem_pool->mp_label, _mem_pool->mp_rreq, _mem_pool->mp_rfail));
-	return;
+	pat = _mm_set1_epi8((char)c);
+	for (i = 0; i + 16 <= n; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(p + i));
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, pat));
+		if (mask != 0xffff) {
+			for (mask = ~mask; (mask & 1) == 0; mask >>= 1)
+				++i;
+			return ((long)i);
+		}
+	}
+#else
+	u_long pat, v;
+
+	memset(&pat, c, sizeof(pat));
+	for (i = 0; i + sizeof(u_long) <= n; i += sizeof(u_long)) {
+		memcpy(&v, p + i, sizeof(v));
+		if (v != pat)
+			break;
+	}
+#endif	/* __SSE2__ */
+	for (; i < n; i++)
+		if (p[i] != (u_char)c)
+			return ((long)i);
+	return (-1);
 }
 
-void
-mem_stats()
+#endif	/* MEM_REDZONE || MEM_QUARANTINE */
+
+#if defined (MEM_REDZONE)
+
+static size_t
+mem_pagesize()
+{
+	static size_t pgsiz;
+#if defined (_WIN32) || defined (_WINDOWS)
+	SYSTEM_INFO si;
+
+	if (pgsiz == 0) {
+		GetSystemInfo(&si);
+		pgsiz = si.dwPageSize;
+	}
+#else
+	if (pgsiz == 0)
+		pgsiz = sysconf(_SC_PAGESIZE);
+#endif	/* _WIN32 || _WINDOWS */
+	return (pgsiz);
+}
+
+/*
+ * Bytes between the end of a guarded block and its guard page.  A 0
+ * byte block is placed as a 1 byte one, inside the data page.
+ */
+#define MEM_GUARD_SLOP(siz)						\
+	(((siz) == 0 ? MEM_GUARD_ALIGN :				\
+	 ((siz) + MEM_GUARD_ALIGN - 1) & ~(MEM_GUARD_ALIGN - 1)) - (siz))
+
+static size_t
+mem_guard_len(size)
+	size_t	size;
+{
+	size_t pg;
+
+	pg = mem_pagesize();
+	/* Data pages plus the guard page */
+	return (((size + MEM_GUARD_SLOP(size) + pg - 1) & ~(pg - 1)) + pg);
+}
+
+static int
+mem_guarded(size, file, line)
+	size_t	size;
+	const	char *file;
+	int	line;
+{
+	struct mem_guard *g;
+
+	for (g = _mem_guard; g < &_mem_guard[_mem_nguard]; g++) {
+		if (g->mg_file == NULL) {
+			if (size >= g->mg_lo && size <= g->mg_hi)
+				return (1);
+		} else if ((g->mg_line == 0 || g->mg_line == line) &&
+		    strcmp(g->mg_file, file) == 0)
+			return (1);
+	}
+	return (0);
+}
+
+/*
+ * Allocate the memory behind a tracked block and fill its redzones.
+ */
+static void *
+mem_rz_alloc(size, flags)
+	size_t	size;
+	int	flags;
+{
+	u_char *raw, *p;
+	size_t len;
+#if defined (_WIN32) || defined (_WINDOWS)
+	DWORD old;
+#endif	/* _WIN32 || _WINDOWS */
+
+	if ((flags & MEM_FLAG_GUARD) != 0) {
+		len = mem_guard_len(size);
+#if defined (_WIN32) || defined (_WINDOWS)
+		raw = VirtualAlloc(NULL, len, MEM_RESERVE | MEM_COMMIT,
+		    PAGE_READWRITE);
+		if (raw == NULL)
+			return (NULL);
+		VirtualProtect(raw + len - mem_pagesize(), mem_pagesize(),
+		    PAGE_NOACCESS, &old);
+#else
+		raw = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANON, -1, 0);
+		if (raw == MAP_FAILED)
+			return (NULL);
+		mprotect(raw + len - mem_pagesize(), mem_pagesize(),
+		    PROT_NONE);
+#endif	/* _WIN32 || _WINDOWS */
+		p = raw + len - mem_pagesize() - size - MEM_GUARD_SLOP(size);
+		memset(p + size, MEM_RZ_BYTE, MEM_GUARD_SLOP(size));
+		return (p);
+	}
+	if ((raw = malloc(size + 2 * MEM_RZ_SIZE)) == NULL)
+		return (NULL);
+	p = raw + MEM_RZ_SIZE;
+	memset(raw, MEM_RZ_BYTE, MEM_RZ_SIZE);
+	memset(p + size, MEM_RZ_BYTE, MEM_RZ_SIZE);
+	return (p);
+}
+
+static void
+mem_rz_release(p, size, flags)
+	u_char	*p;
+	size_t	size;
+	int	flags;
+{
+	size_t pg;
+
+	if ((flags & MEM_FLAG_GUARD) != 0) {
+		pg = mem_pagesize();
+#if defined (_WIN32) || defined (_WINDOWS)
+		VirtualFree((void *)((u_long)p & ~(pg - 1)), 0, MEM_RELEASE);
+#else
+		munmap((void *)((u_long)p & ~(pg - 1)), mem_guard_len(size));
+#endif	/* _WIN32 || _WINDOWS */
+	} else
+		free(p - MEM_RZ_SIZE);
+	return;
+}
+
+/* Who is checking, named in `buf' the first time a canary is bad */
+static const char *
+mem_rz_who(buf, len, fn, file, line)
+	char	*buf;
+	size_t	len;
+	const	char *fn;
+	const	char *file;
+	int	line;
+{
+
+	if (buf[0] != '\0')
+		return (buf);
+	if (file != NULL)
+		snprintf(buf, len, "%s: (%s:%d)", fn, file, line);
+	else
+		snprintf(buf, len, "%s", fn);
+	return (buf);
+}
+
+/*
+ * Verify the canaries of a tracked block, `fn', `file' and `line' tell
+ * who is checking (`file' may be NULL.)  Returns non-zero when the
+ * block was overrun.
+ */
+static int
+mem_rz_check(m, fn, file, line)
+	struct	mem_chunk *m;
+	const	char *fn;
+	const	char *file;
+	int	line;
+{
+	struct mem_chunk *prev;
+	u_char *p;
+	long off;
+	int bad;
+	char who[256];
+
+	who[0] = '\0';
+	p = m->mc_p;
+	bad = 0;
+	if ((m->mc_flags & MEM_FLAG_GUARD) != 0) {
+		off = mem_chkfill(p + m->mc_size, MEM_RZ_BYTE,
+		    MEM_GUARD_SLOP(m->mc_size));
+		if (off >= 0) {
+			MLOG(("%s: 0x%lx (%d bytes) from %s:%d: "
+			    "overrun at offset %d\n", mem_rz_who(who,
+			    sizeof(who), fn, file, line), (u_long)p,
+			    m->mc_size, MEM_SITE(m)->ms_file,
+			    MEM_SITE(m)->ms_line, m->mc_size + (int)off));
+			++bad;
+		}
+		return (bad);
+	}
+	if ((m->mc_flags & MEM_FLAG_REDZONE) == 0)
+		return (0);
+	off = mem_chkfill(p - MEM_RZ_SIZE, MEM_RZ_BYTE, MEM_RZ_SIZE);
+	if (off >= 0) {
+		MLOG(("%s: 0x%lx (%d bytes) from %s:%d: "
+		    "underrun at offset %d\n", mem_rz_who(who, sizeof(who),
+		    fn, file, line), (u_long)p,
+		    m->mc_size, MEM_SITE(m)->ms_file, MEM_SITE(m)->ms_line,
+		    (int)off - MEM_RZ_SIZE));
+		/* Most likely an overrun of the block below it */
+		prev = mem_chunk_below((u_long)p - MEM_RZ_SIZE - 1);
+		if (prev != NULL)
+			MLOG(("%s: 0x%lx: block below is 0x%lx (%d bytes) "
+			    "from %s:%d\n", who, (u_long)p,
+			    (u_long)prev->mc_p, prev->mc_size,
+			    MEM_SITE(prev)->ms_file, MEM_SITE(prev)->ms_line));
+		++bad;
+	}
+	off = mem_chkfill(p + m->mc_size, MEM_RZ_BYTE, MEM_RZ_SIZE);
+	if (off >= 0) {
+		MLOG(("%s: 0x%lx (%d bytes) from %s:%d: "
+		    "overrun at offset %d\n", mem_rz_who(who, sizeof(who),
+		    fn, file, line), (u_long)p,
+		    m->mc_size, MEM_SITE(m)->ms_file, MEM_SITE(m)->ms_line,
+		    m->mc_size + (int)off));
+		++bad;
+	}
+	return (bad);
+}
+
+#endif	/* MEM_REDZONE */
+
+/*
+ * Give the memory of a block allocated by _mem_malloc() back.
+ */
+static void
+mem_release(p, size, flags)
+	void	*p;
+	size_t	size;
+	int	flags;
+{
+
+#if defined (MEM_REDZONE)
+	if (flags != 0)
+		mem_rz_release(p, size, flags);
+	else
+#endif	/* MEM_REDZONE */
+		free(p);
+	return;
+}
+
+#if defined (MEM_QUARANTINE)
+
+/* Memory held by a quarantined block */
+static size_t
+mem_quar_len(size, flags)
+	size_t	size;
+	int	flags;
+{
+
+#if defined (MEM_REDZONE)
+	if ((flags & MEM_FLAG_GUARD) != 0)
+		return (mem_guard_len(size));
+	if ((flags & MEM_FLAG_REDZONE) != 0)
+		return (size + 2 * MEM_RZ_SIZE);
+#endif	/* MEM_REDZONE */
+	return (size);
+}
+
+/*
+ * Verify the poison of quarantined block `q', returns non-zero if it
+ * was written to after being freed.  Guarded blocks are inaccessible
+ * while quarantined and need no checking.
+ */
+static int
+mem_quar_check(q, fn)
+	struct	mem_quar *q;
+	const	char *fn;
+{
+	long off;
+
+	if ((q->mq_flags & MEM_FLAG_GUARD) != 0)
+		return (0);
+	if ((off = mem_chkfill(q->mq_p, MEM_QUAR_BYTE, q->mq_size)) < 0)
+		return (0);
+	MLOG(("%s: 0x%lx (%d bytes) from %s:%d freed at %s:%d: "
+	    "written after free at offset %ld\n", fn, (u_long)q->mq_p,
+	    q->mq_size, _mem_site[q->mq_asid].ms_file,
+	    _mem_site[q->mq_asid].ms_line, _mem_site[q->mq_fsid].ms_file,
+	    _mem_site[q->mq_fsid].ms_line,
+	    off));
+	return (1);
+}
+
+/* Verify and really free the oldest quarantined block */
+static void
+mem_quar_pop()
+{
+	struct mem_quar *q;
+
+	q = &_mem_quar[_mem_qhead];
+	_mem_qhead = (_mem_qhead + 1) % MEM_QUAR_FREES;
+	--_mem_qlen;
+	_mem_qbytes -= mem_quar_len(q->mq_size, q->mq_flags);
+	mem_quar_check(q, "mem_quarantine");
+	mem_bloom_update(q->mq_p, -1);
+	mem_release(q->mq_p, q->mq_size, q->mq_flags);
+	return;
+}
+
+/*
+ * Put block of record `m' in quarantine on behalf of _mem_free() at
+ * `sd'.  Blocks larger than the whole quarantine are freed right
+ * away.  A quarantined block stays in the pointer filter, so that a
+ * second free of it takes the lock and is found by mem_quar_freed().
+ */
+static void
+mem_quar_put(m, sd)
+	struct	mem_chunk *m;
+	struct	mem_sitedesc *sd;
+{
+	struct mem_quar *q;
+	size_t len;
+#if defined (MEM_REDZONE) && (defined (_WIN32) || defined (_WINDOWS))
+	DWORD old;
+#endif	/* MEM_REDZONE && (_WIN32 || _WINDOWS) */
+
+	len = mem_quar_len(m->mc_size, m->mc_flags);
+	if (len > _mem_qmaxbytes || _mem_qmaxfrees == 0) {
+		mem_release(m->mc_p, m->mc_size, m->mc_flags);
+		return;
+	}
+	while (_mem_qlen > 0 && (_mem_qlen >= _mem_qmaxfrees ||
+	    _mem_qbytes + len > _mem_qmaxbytes))
+		mem_quar_pop();
+	q = &_mem_quar[(_mem_qhead + _mem_qlen) % MEM_QUAR_FREES];
+	q->mq_p		= m->mc_p;
+	q->mq_size	= m->mc_size;
+	q->mq_flags	= m->mc_flags;
+	q->mq_asid	= m->mc_sid;
+	q->mq_fsid	= MEM_SD_ID(sd, MEM_TYPE_FREE);
+	mem_bloom_update(m->mc_p, 1);
+#if defined (MEM_REDZONE)
+	if ((m->mc_flags & MEM_FLAG_GUARD) != 0)
+# if defined (_WIN32) || defined (_WINDOWS)
+		VirtualProtect((void *)((u_long)m->mc_p &
+		    ~(mem_pagesize() - 1)), mem_guard_len(m->mc_size) -
+		    mem_pagesize(), PAGE_NOACCESS, &old);
+# else
+		mprotect((void *)((u_long)m->mc_p & ~(mem_pagesize() - 1)),
+		    mem_guard_len(m->mc_size) - mem_pagesize(), PROT_NONE);
+# endif	/* _WIN32 || _WINDOWS */
+	else
+#endif	/* MEM_REDZONE */
+		memset(m->mc_p, MEM_QUAR_BYTE, m->mc_size);
+	++_mem_qlen;
+	_mem_qbytes += len;
+	return;
+}
+
+/*
+ * Report `ptr', not in the hash, if it is a quarantined block being
+ * freed again by `fn' at `sd'.  Returns non-zero if it was, the block
+ * must then be left alone.  Called with the lock held.
+ */
+static int
+mem_quar_freed(ptr, fn, sd)
+	void	*ptr;
+	const	char *fn;
+	struct	mem_sitedesc *sd;
+{
+	struct mem_quar *q;
+	int i;
+
+	for (i = _mem_qlen - 1; i >= 0; i--) {
+		q = &_mem_quar[(_mem_qhead + i) % MEM_QUAR_FREES];
+		if (q->mq_p != ptr)
+			continue;
+		MLOG(("%s: (%s:%d): 0x%lx (%d bytes) from %s:%d: double "
+		    "free (first freed at %s:%d)\n", fn, sd->sd_file,
+		    sd->sd_line, (u_long)ptr, q->mq_size,
+		    _mem_site[q->mq_asid].ms_file,
+		    _mem_site[q->mq_asid].ms_line,
+		    _mem_site[q->mq_fsid].ms_file,
+		    _mem_site[q->mq_fsid].ms_line));
+		return (1);
+	}
+	return (0);
+}
+
+#endif	/* MEM_QUARANTINE */
+
+/*
+ * Monotonic time in nanoseconds.
+ */
+static u_int64_t
+mem_nsec()
+{
+#if defined (_WIN32) || defined (_WINDOWS)
+	LARGE_INTEGER c, f;
+
+	QueryPerformanceCounter(&c);
+	QueryPerformanceFrequency(&f);
+	return ((u_int64_t)((double)c.QuadPart * 1e9 / f.QuadPart));
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec);
+#endif	/* _WIN32 || _WINDOWS */
+}
+
+/*
+ * Cheap clock for stamping records, in TSC ticks if MEM_TSC else
+ * nanoseconds.  Ticks are converted when reporting (mem_tick_ns()).
+ */
+static u_int64_t
+mem_clock()
+{
+#if defined (MEM_TSC)
+	u_int lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((u_int64_t)hi << 32 | lo);
+#else
+	return (mem_nsec());
+#endif	/* MEM_TSC */
+}
+
+/* Nanoseconds per mem_clock() tick, measured since mem_init() */
+static double
+mem_tick_ns()
+{
+#if defined (MEM_TSC)
+	u_int64_t t, ns;
+
+	t = mem_clock() - _mem_tick0;
+	ns = mem_nsec() - _mem_nsec0;
+	if (t == 0 || ns == 0)
+		return (1.0);
+	return ((double)ns / t);
+#else
+	return (1.0);
+#endif	/* MEM_TSC */
+}
+
+/*
+ * A site already known as `file':`line' of `type' under another
+ * address of the same file name, 0 if none.  Site names are set
+ * before their ids are published and cleared on spare ids.
+ */
+static u_int
+mem_site_alias(file, line, type)
+	const	char *file;
+	int	line;
+	int	type;
+{
+	struct mem_site *ms;
+	u_int id, n;
+
+	n = _mem_nsites < MEM_SITES ? _mem_nsites : MEM_SITES;
+	for (id = 1; id < n; id++) {
+		ms = &_mem_site[id];
+		if (ms->ms_line == line && ms->ms_type == type &&
+		    ms->ms_file != NULL && strcmp(ms->ms_file, file) == 0)
+			return (id);
+	}
+	return (0);
+}
+
+/*
+ * Dense id of the site `file':`line' allocating (or freeing) blocks of
+ * `type', given out the first time it is seen.  Sites are hashed by
+ * the address of the file name, as recorded by __FILE__; a name seen
+ * at another address (another object file, no string merging) is
+ * matched by mem_site_alias() and gets its own slot, holding the id
+ * already given out.  Known sites are found without locking, usually
+ * in one probe; new ones are published with a compare and swap, an id
+ * taken for a slot lost to another thread is kept for the next new
+ * site.  Returns 0, the unknown site, when all ids are taken.
+ */
+static u_int
+mem_site_id(file, line, type)
+	const	char *file;
+	int	line;
+	int	type;
+{
+	struct mem_site *ms;
+	u_int h, n, id, new;
+	int made;
+
+	if (file == NULL)
+		file = "?";
+	h = (u_int)(((u_long)file >> 3) ^ ((u_int)line * 2654435761U) ^
+	    (u_int)type) % MEM_SITE_HASH;
+	new = 0;
+	made = 0;
+	for (n = 0; n < MEM_SITE_HASH; n++) {
+		if ((id = ((volatile u_int *)_mem_site_hash)[h]) == 0) {
+			if (new == 0 &&
+			    (new = mem_site_alias(file, line, type)) == 0) {
+				if ((new = _mem_site_spare) == 0 ||
+				    !__sync_bool_compare_and_swap(
+				    &_mem_site_spare, new, 0))
+					new = 0;
+				if (new == 0 && (_mem_nsites >= MEM_SITES ||
+				    (new = __sync_fetch_and_add(&_mem_nsites,
+				    1)) >= MEM_SITES)) {
+					++_mem_nsitelost;
+					return (0);
+				}
+				ms = &_mem_site[new];
+				ms->ms_line = line;
+				ms->ms_type = type;
+				ms->ms_file = file;
+				if (_mem_pm != NULL)
+					mem_pm_site(new, file, line, type);
+				__sync_synchronize();
+				made = 1;
+			}
+			if (__sync_bool_compare_and_swap(&_mem_site_hash[h],
+			    0, new))
+				return (new);
+			/* Somebody else took the slot, look at it again */
+			id = _mem_site_hash[h];
+		}
+		ms = &_mem_site[id];
+		if (ms->ms_line == line && ms->ms_type == type &&
+		    (ms->ms_file == file || strcmp(ms->ms_file, file) == 0)) {
+			if (made && new != id) {
+				/* Ours lost the race, keep the id */
+				_mem_site[new].ms_file = NULL;
+				__sync_synchronize();
+				__sync_bool_compare_and_swap(&_mem_site_spare,
+				    0, new);
+			}
+			return (id);
+		}
+		if (++h == MEM_SITE_HASH)
+			h = 0;
+	}
+	return (0);
+}
+
+/* Histogram bucket of lifetime `t' */
+static int
+mem_lt_bucket(t)
+	u_int64_t t;
+{
+	int e, b;
+
+	if (t < MEM_LT_SUB)
+		return ((int)t);
+#if defined (__GNUC__)
+	e = 63 - __builtin_clzll(t);
+#else
+	for (e = 0; (t >> e) > 1; e++)
+		;
+#endif	/* __GNUC__ */
+	b = (e - MEM_LT_SUBBITS + 1) * MEM_LT_SUB +
+	    (int)((t >> (e - MEM_LT_SUBBITS)) & (MEM_LT_SUB - 1));
+	return (b < MEM_LT_BUCKETS ? b : MEM_LT_BUCKETS - 1);
+}
+
+/* Size class of `size': 0 for 0 bytes, else 1 + log2(size) */
+static int
+mem_sz_class(size)
+	u_long	size;
+{
+	int c;
+
+	if (size == 0)
+		return (0);
+#if defined (__GNUC__)
+	c = 8 * sizeof(u_long) - __builtin_clzl(size);
+#else
+	for (c = 0; size != 0; size >>= 1)
+		c++;
+#endif	/* __GNUC__ */
+	return (c < MEM_SIZE_CLASSES ? c : MEM_SIZE_CLASSES - 1);
+}
+
+/* Smallest lifetime counted in bucket `b' */
+static u_int64_t
+mem_lt_value(b)
+	int	b;
+{
+	int e;
+
+	if (b < MEM_LT_SUB)
+		return ((u_int64_t)b);
+	e = b / MEM_LT_SUB + MEM_LT_SUBBITS - 1;
+	return ((u_int64_t)(MEM_LT_SUB + b % MEM_LT_SUB) <<
+	    (e - MEM_LT_SUBBITS));
+}
+
+/*
+ * Account a new record to its site and stamp it, mc_sid and mc_size
+ * must be set.
+ */
+static void
+mem_site_alloc(m)
+	struct	mem_chunk *m;
+{
+	struct mem_site *ms;
+	struct mem_gen *g;
+
+	m->mc_stamp = mem_clock();
+	_mem_lbytes += m->mc_size;
+	++_mem_lcount;
+	ms = MEM_SITE(m);
+	++ms->ms_nalloc;
+	ms->ms_bytes += m->mc_size;
+	++ms->ms_sizes[mem_sz_class(m->mc_size)];
+	mem_tag_add(m->mc_tag, m->mc_size, 1);
+	if (_mem_gen_id != 0 && (g = mem_gen_find(m->mc_seq)) != NULL) {
+		++g->gn_count[m->mc_sid];
+		g->gn_bytes[m->mc_sid] += m->mc_size;
+	}
+	/* Both the byte and the count watermark are at least this far */
+	if ((_mem_wm_credit -= m->mc_size + 1) < 0)
+		mem_wm_check();
+	return;
+}
+
+/* Record the lifetime of a block going away */
+static void
+mem_site_free(m)
+	struct	mem_chunk *m;
+{
+	struct mem_site *ms;
+	struct mem_gen *g;
+
+	_mem_lbytes -= m->mc_size;
+	--_mem_lcount;
+	ms = MEM_SITE(m);
+	++ms->ms_nfree;
+	ms->ms_fbytes += m->mc_size;
+	++ms->ms_life[mem_lt_bucket(mem_clock() - m->mc_stamp)];
+	mem_tag_add(m->mc_tag, -(long)m->mc_size, -1);
+	if (_mem_gen_id != 0 && (g = mem_gen_find(m->mc_seq)) != NULL) {
+		--g->gn_count[m->mc_sid];
+		g->gn_bytes[m->mc_sid] -= m->mc_size;
+	}
+	return;
+}
+
+/*
+ * Generation of the record numbered `seq', NULL if it was made before
+ * the first mem_mark().  Newest first, as most blocks are young.
+ */
+static struct mem_gen *
+mem_gen_find(seq)
+	u_long	seq;
+{
+	struct mem_gen *g;
+	u_long id;
+
+	for (id = _mem_gen_id; id != 0 && id + MEM_GENS > _mem_gen_id; id--) {
+		g = &_mem_gen[id % MEM_GENS];
+		if (seq >= g->gn_seq)
+			return (g);
+	}
+	return (NULL);
+}
+
+/* Take a slot of counters for this thread, see MEM_THR_SLOTS */
+static struct mem_thr *
+mem_thr_slot()
+{
+	struct mem_thr *th;
+#if defined (MEM_THREADS)
+	int i;
+#endif	/* MEM_THREADS */
+
+	th = &_mem_thr[0];
+#if defined (MEM_THREADS)
+	for (i = 1; i < MEM_THR_SLOTS; i++)
+		if (_mem_thr[i].th_used == 0 &&
+		    __sync_bool_compare_and_swap(&_mem_thr[i].th_used, 0, 1)) {
+			th = &_mem_thr[i];
+			break;
+		}
+	/* Given back, or for slot 0 only left, by mem_thr_exit() */
+	pthread_setspecific(_mem_thr_key, th);
+#endif	/* MEM_THREADS */
+	_mem_thr_cur = th;
+	return (th);
+}
+
+/*
+ * Charge `bytes' and `count' blocks to tag `tag' in the counters of
+ * this thread, merged when they grow large.  Called with the lock
+ * held.
+ */
+static void
+mem_tag_add(tag, bytes, count)
+	int	tag;
+	long	bytes;
+	long	count;
+{
+	struct mem_thr *th;
+
+	if ((th = _mem_thr_cur) == NULL)
+		th = mem_thr_slot();
+	th->th_tag_db[tag] += bytes;
+	th->th_tag_dc[tag] += count;
+	if (th->th_tag_db[tag] >= MEM_TAG_FLUSH ||
+	    th->th_tag_db[tag] <= -MEM_TAG_FLUSH)
+		mem_tag_merge(tag, th);
+	return;
+}
+
+/*
+ * Merge what the thread of slot `th' counted for `tag', or every
+ * thread if `th' is NULL, into its totals and check the budget.
+ * Called with the lock held.
+ */
+static void
+mem_tag_merge(tag, th)
+	int	tag;
+	struct	mem_thr *th;
+{
+	struct mem_tag *mt;
+	int i;
+
+	mt = &_mem_tag[tag];
+	for (i = 0; i < MEM_THR_SLOTS; i++) {
+		if (th != NULL && th != &_mem_thr[i])
+			continue;
+		mt->mt_bytes += _mem_thr[i].th_tag_db[tag];
+		mt->mt_count += _mem_thr[i].th_tag_dc[tag];
+		_mem_thr[i].th_tag_db[tag] = _mem_thr[i].th_tag_dc[tag] = 0;
+	}
+	if (mt->mt_bytes > mt->mt_peak)
+		mt->mt_peak = mt->mt_bytes;
+	if (mt->mt_budget == 0)
+		return;
+	if (mt->mt_over) {
+		if (mt->mt_bytes <= (long)mt->mt_budget)
+			mt->mt_over = 0;
+		return;
+	}
+	if (mt->mt_bytes <= (long)mt->mt_budget)
+		return;
+	mt->mt_over = 1;
+	++mt->mt_nover;
+	if (mt->mt_cb == NULL)
+		return;
+	mt->mt_fire = 1;
+#if defined (MEM_THREADS)
+	/* The callback runs on the reporter thread, outside the lock */
+	if (_mem_reporter) {
+		_mem_wm_pending |= MEM_WM_TAGS;
+		pthread_cond_signal(&_mem_wm_cv);
+		return;
+	}
+#endif	/* MEM_THREADS */
+	/* or once this thread lets go of the lock, see MEM_UNLOCK() */
+	_mem_tag_due = 1;
+	return;
+}
+
+/* Call the callbacks of the tags that went over budget */
+static void
+mem_tag_fire()
+{
+	struct mem_tag *mt;
+	void (*cb)(int,long,void *);
+	void *arg;
+	long bytes;
+	int t;
+
+	for (;;) {
+		MEM_LOCK();
+		_mem_tag_due = 0;
+		for (t = 0; t < _mem_ntags && !_mem_tag[t].mt_fire; t++)
+			;
+		if (t == _mem_ntags) {
+			MEM_UNLOCK();
+			break;
+		}
+		mt = &_mem_tag[t];
+		mt->mt_fire = 0;
+		cb = mt->mt_cb;
+		arg = mt->mt_arg;
+		bytes = mt->mt_bytes;
+		MEM_UNLOCK();
+		if (cb != NULL)
+			(*cb)(t, bytes, arg);
+	}
+	return;
+}
+
+/* Live bytes and blocks of every tag in use, for mem_stats() */
+static void
+mem_tag_report()
+{
+	struct mem_tag *mt;
+	int t;
+
+	if (_mem_ntags == 1 && _mem_tag[0].mt_budget == 0)
+		return;
+	MREPORT((">> tags:\n"));
+	for (t = 0; t < _mem_ntags; t++) {
+		mem_tag_merge(t, NULL);
+		mt = &_mem_tag[t];
+		MREPORT(("\t%-24s %12ld bytes %10ld blocks, peak %ld",
+		    mt->mt_name, mt->mt_bytes, mt->mt_count, mt->mt_peak));
+		if (mt->mt_budget != 0)
+			MREPORT((", budget %lu%s", (u_long)mt->mt_budget,
+			    mt->mt_over ? " EXCEEDED" : ""));
+		MREPORT(("\n"));
+	}
+	return;
+}
+
+#if !defined (MEM_NO_SELF)
+/* Cycle counter for timing the entry points, nanoseconds without one */
+static u_int64_t
+mem_cycles()
+{
+#if defined (MEM_SELF_TSC)
+	u_int lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((u_int64_t)hi << 32 | lo);
+#else
+	return (mem_nsec());
+#endif	/* MEM_SELF_TSC */
+}
+
+/* Take a slot of cost counters for this thread */
+static struct mem_cost *
+mem_self_slot()
+{
+	struct mem_cost *c;
+#if defined (MEM_THREADS)
+	int i;
+#endif	/* MEM_THREADS */
+
+	c = &_mem_cost[0];
+#if defined (MEM_THREADS)
+	for (i = 1; i < MEM_SELF_THREADS; i++)
+		if (_mem_cost[i].co_used == 0 &&
+		    __sync_bool_compare_and_swap(&_mem_cost[i].co_used, 0, 1)) {
+			c = &_mem_cost[i];
+			break;
+		}
+	/* Given back by mem_thr_exit() */
+	if (_mem_thr_cur == NULL)
+		(void)mem_thr_slot();
+#endif	/* MEM_THREADS */
+	_mem_cost_cur = c;
+	return (c);
+}
+
+/*
+ * Count `t' ticks spent in entry point `path' (MEM_SELF_*) to this
+ * thread, without the lock.
+ */
+static void
+mem_self_add(path, t)
+	int	path;
+	u_int64_t t;
+{
+	struct mem_cost *c;
+
+	if ((c = _mem_cost_cur) == NULL)
+		c = mem_self_slot();
+	++c->co_calls[path];
+	c->co_time[path] += t;
+	if (t > c->co_max[path])
+		c->co_max[path] = t;
+	++c->co_hist[path][mem_sz_class((u_long)t)];
+	return;
+}
+#endif	/* !MEM_NO_SELF */
+
+#if defined (MEM_THREADS)
+/* Fold the costs of an exiting thread into slot 0, with the lock held */
+static void
+mem_self_exit()
+{
+	struct mem_cost *c, *all;
+	int p, b;
+
+	if ((c = _mem_cost_cur) == NULL || c == &_mem_cost[0])
+		return;
+	all = &_mem_cost[0];
+	for (p = 0; p < MEM_SELF_PATHS; p++) {
+		all->co_calls[p] += c->co_calls[p];
+		all->co_time[p] += c->co_time[p];
+		if (c->co_max[p] > all->co_max[p])
+			all->co_max[p] = c->co_max[p];
+		for (b = 0; b < MEM_SIZE_CLASSES; b++)
+			all->co_hist[p][b] += c->co_hist[p][b];
+	}
+	memset(c->co_calls, 0, sizeof(c->co_calls));
+	memset(c->co_time, 0, sizeof(c->co_time));
+	memset(c->co_max, 0, sizeof(c->co_max));
+	memset(c->co_hist, 0, sizeof(c->co_hist));
+	__sync_synchronize();
+	c->co_used = 0;
+	_mem_cost_cur = NULL;
+	return;
+}
+#endif	/* MEM_THREADS */
+
+/* Bytes of [`addr', `addr' + `len') in core, 0 if that is unknown */
+static u_long
+mem_resident(addr, len)
+	const	void *addr;
+	size_t	len;
+{
+#if defined (unix) || defined (__unix__)
+	u_char vec[256];
+	u_long pg, lo, hi, n, in;
+	int i;
+
+	if (addr == NULL || len == 0)
+		return (0);
+	pg = sysconf(_SC_PAGESIZE);
+	lo = (u_long)addr & ~(pg - 1);
+	hi = ((u_long)addr + len + pg - 1) & ~(pg - 1);
+	for (in = 0; lo < hi; lo += n * pg) {
+		n = (hi - lo) / pg;
+		if (n > sizeof(vec))
+			n = sizeof(vec);
+		if (mincore((void *)lo, n * pg, (void *)vec) < 0)
+			return (0);
+		for (i = 0; i < n; i++)
+			in += vec[i] & 1;
+	}
+	return (in * pg);
+#else
+	return (0);
+#endif	/* unix || __unix__ */
+}
+
+/* Smallest power of two above `q' of the counts in `hist' */
+static u_long
+mem_self_pct(hist, q)
+	u_long	*hist;
+	double	q;
+{
+	u_long n, sum;
+	int c;
+
+	for (n = c = 0; c < MEM_SIZE_CLASSES; c++)
+		n += hist[c];
+	for (sum = c = 0; c < MEM_SIZE_CLASSES - 1; c++)
+		if ((sum += hist[c]) >= n * q)
+			break;
+	return (1UL << c);
+}
+
+/* Print what mem_self() gives, with the lock held */
+static void
+mem_self_report()
+{
+	static const char *names[] = { "alloc", "realloc", "free" };
+	struct mem_self_info sx;
+	const char *unit;
+	int p;
+
+	mem_self(&sx);
+	unit = sx.sx_cycles ? "cycles" : "ns";
+	for (p = 0; p < MEM_SELF_PATHS; p++)
+		if (sx.sx_timed[p] != 0)
+			MREPORT(("%s: %lu calls timed, mean %.0f %s, 99%% "
+			    "under %lu, max %lu\n", names[p], sx.sx_timed[p],
+			    (double)sx.sx_time[p] / sx.sx_timed[p], unit,
+			    mem_self_pct(sx.sx_hist[p], 0.99), sx.sx_max[p]));
+	MREPORT(("hash: %lu records in %lu of %lu buckets, load %.2f, "
+	    "longest chain %lu\n", sx.sx_records, sx.sx_bused,
+	    sx.sx_buckets, sx.sx_load, sx.sx_maxchain));
+	if (sx.sx_lookups != 0)
+		MREPORT(("lookups: %lu, mean %.1f steps, 99%% under %lu, "
+		    "longest %lu\n", sx.sx_lookups, (double)sx.sx_probes /
+		    sx.sx_lookups, mem_self_pct(sx.sx_probe_hist, 0.99),
+		    sx.sx_maxprobe));
+	if (sx.sx_gets != 0)
+		MREPORT(("pool: %lu records taken, mean %.1f bitmap bytes "
+		    "searched, most %lu\n", sx.sx_gets,
+		    (double)sx.sx_scan / sx.sx_gets, sx.sx_maxscan));
+	MREPORT(("tables: %lu bytes, %lu resident\n", sx.sx_mapped,
+	    sx.sx_resident));
+	return;
+}
+
+/* Print `ns' nanoseconds in a readable unit */
+static char *
+mem_fmt_ns(buf, len, ns)
+	char	*buf;
+	size_t	len;
+	double	ns;
+{
+
+	if (ns < 1e3)
+		snprintf(buf, len, "%.0fns", ns);
+	else if (ns < 1e6)
+		snprintf(buf, len, "%.1fus", ns / 1e3);
+	else if (ns < 1e9)
+		snprintf(buf, len, "%.1fms", ns / 1e6);
+	else
+		snprintf(buf, len, "%.1fs", ns / 1e9);
+	return (buf);
+}
+
+/* Lifetime (in ns) below which fraction `q' of the freed blocks died */
+static double
+mem_lt_quantile(ms, q, tick)
+	struct	mem_site *ms;
+	double	q;
+	double	tick;
+{
+	u_long n, want;
+	int b;
+
+	want = (u_long)(q * ms->ms_nfree);
+	if (want == 0)
+		want = 1;
+	for (b = n = 0; b < MEM_LT_BUCKETS; b++)
+		if ((n += ms->ms_life[b]) >= want)
+			break;
+	if (b == MEM_LT_BUCKETS)
+		b = MEM_LT_BUCKETS - 1;
+	return (mem_lt_value(b) * tick);
+}
+
+/* Copy the counters of `ms' out for the query API */
+static void
+mem_site_fill(ms, si, secs)
+	struct	mem_site *ms;
+	struct	mem_site_info *si;
+	double	secs;
+{
+	int i;
+
+	si->si_file	= ms->ms_file;
+	si->si_line	= ms->ms_line;
+	si->si_nalloc	= ms->ms_nalloc;
+	si->si_bytes	= ms->ms_bytes;
+	si->si_nfree	= ms->ms_nfree;
+	si->si_live	= ms->ms_bytes - ms->ms_fbytes;
+	si->si_rate	= ms->ms_nalloc / secs;
+	for (i = 0; i < MEM_SIZE_CLASSES; i++)
+		si->si_sizes[i] = ms->ms_sizes[i];
+	return;
+}
+
+/* Seconds since mem_init(), never 0 */
+static double
+mem_uptime()
+{
+	double secs;
+
+	secs = (mem_nsec() - _mem_nsec0) / 1e9;
+	return (secs > 0 ? secs : 1e-9);
+}
+
+/* Busiest site first */
+static int
+mem_site_cmp(a, b)
+	const	void *a;
+	const	void *b;
+{
+	const struct mem_site *sa, *sb;
+
+	sa = &_mem_site[*(const int *)a];
+	sb = &_mem_site[*(const int *)b];
+	return (sa->ms_nalloc > sb->ms_nalloc ? -1 :
+	    sa->ms_nalloc < sb->ms_nalloc);
+}
+
+/*
+ * Heap growth watermarks.  The allocation path only decrements
+ * _mem_wm_credit, a lower bound of the bytes plus blocks that can be
+ * allocated before any watermark is reached; mem_wm_check() does the
+ * real comparisons when it runs out.
+ */
+static void
+mem_wm_check()
+{
+	u_int64_t now;
+	u_long left;
+	int why;
+
+	why = 0;
+	if (_mem_wm_bytes != 0 && _mem_lbytes >= _mem_wm_bytes) {
+		why |= MEM_WM_BYTES;
+		_mem_wm_bytes = _mem_lbytes / 100 * MEM_WM_REARM + 1;
+	}
+	if (_mem_wm_count != 0 && _mem_lcount >= _mem_wm_count) {
+		why |= MEM_WM_COUNT;
+		_mem_wm_count = _mem_lcount / 100 * MEM_WM_REARM + 1;
+	}
+	if (_mem_wm_growth != 0 &&
+	    (now = mem_nsec()) - _mem_wm_t0 >= _mem_wm_ival) {
+		if (_mem_lbytes > _mem_wm_b0 &&
+		    _mem_lbytes - _mem_wm_b0 >= _mem_wm_growth)
+			why |= MEM_WM_GROWTH;
+		_mem_wm_t0 = now;
+		_mem_wm_b0 = _mem_lbytes;
+	}
+
+	left = LONG_MAX;
+	if (_mem_wm_bytes != 0 && _mem_wm_bytes - _mem_lbytes < left)
+		left = _mem_wm_bytes - _mem_lbytes;
+	if (_mem_wm_count != 0 && _mem_wm_count - _mem_lcount < left)
+		left = _mem_wm_count - _mem_lcount;
+	if ((_mem_wm_growth != 0 || _mem_shm != NULL || _mem_sig_ival != 0) &&
+	    left > MEM_WM_POLL)
+		left = MEM_WM_POLL;
+	_mem_wm_credit = (long)left;
+#if !defined (MEM_THREADS)
+	/* No reporter thread to keep the exported counters fresh */
+	mem_publish();
+#endif	/* !MEM_THREADS */
+
+	if (why == 0)
+		return;
+#if defined (MEM_THREADS)
+	/* Leave the writing to the reporter thread */
+	if (_mem_reporter) {
+		_mem_wm_pending |= why;
+		pthread_cond_signal(&_mem_wm_cv);
+		return;
+	}
+#endif	/* MEM_THREADS */
+	mem_wm_snapshot(why);
+	return;
+}
+
+/* Biggest site by live bytes first */
+static int
+mem_site_livecmp(a, b)
+	const	void *a;
+	const	void *b;
+{
+	const struct mem_site *sa, *sb;
+	u_long la, lb;
+
+	sa = &_mem_site[*(const int *)a];
+	sb = &_mem_site[*(const int *)b];
+	la = sa->ms_bytes - sa->ms_fbytes;
+	lb = sb->ms_bytes - sb->ms_fbytes;
+	return (la > lb ? -1 : la < lb);
+}
+
+/*
+ * Copy the counters of the (at most `max') sites holding most memory
+ * to `top', returns how many.  Called with the lock held.
+ */
+static int
+mem_top_live(top, max, secs)
+	struct	mem_top *top;
+	int	max;
+	double	secs;
+{
+	struct mem_site *ms;
+	int order[MEM_SITES];
+	int i, n;
+
+	for (i = n = 0; i < MEM_SITES; i++)
+		if (_mem_site[i].ms_bytes != _mem_site[i].ms_fbytes)
+			order[n++] = i;
+	qsort(order, n, sizeof(int), mem_site_livecmp);
+	if (n > max)
+		n = max;
+	for (i = 0; i < n; i++) {
+		ms = &_mem_site[order[i]];
+		top[i].mt_file	= ms->ms_file;
+		top[i].mt_line	= ms->ms_line;
+		top[i].mt_count	= ms->ms_nalloc - ms->ms_nfree;
+		top[i].mt_bytes	= ms->ms_bytes - ms->ms_fbytes;
+		top[i].mt_rate	= ms->ms_nalloc / secs;
+	}
+	return (n);
+}
+
+/*
+ * Format a snapshot of the live memory numbered `snap' (0 for none)
+ * and taken for `why' into `buf', returns its length.  Called with
+ * the lock held.
+ */
+static size_t
+mem_snap_format(buf, len, snap, why)
+	char	*buf;
+	size_t	len;
+	int	snap;
+	int	why;
+{
+	struct mem_top top[MEM_SITE_TOP];
+	char num[16];
+	double secs;
+	size_t off;
+	int i, n, r;
+
+	secs = mem_uptime();
+	n = mem_top_live(top, MEM_SITE_TOP, secs);
+	num[0] = '\0';
+	if (snap != 0)
+		snprintf(num, sizeof(num), " %d", snap);
+	r = snprintf(buf, len, "** Memory watchdog snapshot%s at %.3fs:"
+	    "%s%s%s%s%s\n%lu bytes in %lu blocks live\n", num, secs,
+	    (why & MEM_WM_BYTES) ? " bytes" : "",
+	    (why & MEM_WM_COUNT) ? " count" : "",
+	    (why & MEM_WM_GROWTH) ? " growth" : "",
+	    (why & MEM_WM_USER) ? " requested" : "",
+	    (why & MEM_WM_SIGNAL) ? " signal" : "", _mem_lbytes, _mem_lcount);
+	off = r > 0 ? (size_t)r : 0;
+	/* Room for the last line is kept, a site too many is dropped */
+	for (i = 0; i < n && off < len; i++) {
+		r = snprintf(buf + off, len - off,
+		    "\t%s:%d: %lu bytes in %lu blocks, %.1f allocs/s\n",
+		    top[i].mt_file, top[i].mt_line, top[i].mt_bytes,
+		    top[i].mt_count, top[i].mt_rate);
+		if (r < 0 || off + r + sizeof("DONE\n") > len)
+			break;
+		off += r;
+	}
+	if (off + sizeof("DONE\n") <= len) {
+		memcpy(buf + off, "DONE\n", sizeof("DONE\n") - 1);
+		off += sizeof("DONE\n") - 1;
+	}
+	return (off);
+}
+
+/*
+ * Write the sites holding most memory to a new snapshot file (or
+ * stdout).  The snapshot is formatted under the lock, the file is
+ * written without it.
+ */
+static void
+mem_wm_snapshot(why)
+	int	why;
+{
+	char buf[MEM_SIG_BUF], path[1024];
+	size_t len;
+	int snap;
+	FILE *fp;
+
+	MEM_LOCK();
+	snap = ++_mem_wm_nsnap;
+	len = mem_snap_format(buf, sizeof(buf), snap, why);
+	fp = stdout;
+	if (_mem_wm_prefix != NULL) {
+		snprintf(path, sizeof(path), "%s.%d.%d", _mem_wm_prefix,
+		    (int)getpid(), snap);
+		if ((fp = fopen(path, "w")) == NULL) {
+			MLOG(("mem_watermark: %s: cannot create\n", path));
+			fp = stdout;
+		}
+	}
+	MEM_UNLOCK();
+
+	fwrite(buf, 1, len, fp);
+	if (fp != stdout)
+		fclose(fp);
+	else
+		fflush(fp);
+	return;
+}
+
+/*
+ * Update the exported counters, called with the lock held.
+ */
+static void
+mem_shm_publish()
+{
+	struct mem_top top[MEM_SHM_TOP];
+	struct mem_shm *sh;
+	struct mem_shm_site *ss;
+	size_t len;
+	double secs;
+	int i, n;
+
+	if ((sh = _mem_shm) == NULL)
+		return;
+	secs = mem_uptime();
+	n = mem_top_live(top, MEM_SHM_TOP, secs);
+
+	++sh->sh_seq;
+	__sync_synchronize();
+	sh->sh_uptime	= secs;
+	++sh->sh_updates;
+	sh->sh_nobjs	= _mem_pool->mp_nobjs;
+	sh->sh_nalloc	= _mem_pool->mp_nalloc;
+	sh->sh_napeek	= _mem_pool->mp_napeek;
+	sh->sh_afail	= _mem_pool->mp_afail;
+	if (_mem_pool->mp_rlive != NULL) {
+		sh->sh_committed = (u_long)_mem_pool->mp_ncommit <<
+		    _mem_pool->mp_runshift;
+		sh->sh_reserved = _mem_pool->mp_mapsz;
+	} else
+		sh->sh_committed = sh->sh_reserved =
+		    (u_long)_mem_pool->mp_nobjs * _mem_pool->mp_rsiz;
+	sh->sh_lbytes	= _mem_lbytes;
+	sh->sh_lcount	= _mem_lcount;
+	sh->sh_nsites	= (_mem_nsites < MEM_SITES ?
+	    _mem_nsites : MEM_SITES) - 1;
+	sh->sh_nsnap	= _mem_wm_nsnap;
+	for (i = 0; i < n; i++) {
+		ss = &sh->sh_top[i];
+		/* Keep the end of long paths */
+		if ((len = strlen(top[i].mt_file)) >= sizeof(ss->ss_file))
+			top[i].mt_file += len - sizeof(ss->ss_file) + 1;
+		strncpy(ss->ss_file, top[i].mt_file, sizeof(ss->ss_file));
+		ss->ss_file[sizeof(ss->ss_file) - 1] = '\0';
+		ss->ss_line	= top[i].mt_line;
+		ss->ss_count	= top[i].mt_count;
+		ss->ss_bytes	= top[i].mt_bytes;
+		ss->ss_rate	= top[i].mt_rate;
+	}
+	sh->sh_ntop	= n;
+	__sync_synchronize();
+	++sh->sh_seq;
+	_mem_shm_t0 = mem_nsec();
+	return;
+}
+
+/*
+ * Format the next snapshot for mem_signal() into the buffer the
+ * handler is not using and switch to it.  Called with the lock held.
+ */
+static void
+mem_sig_refresh()
+{
+	int i;
+
+	i = !_mem_sig_cur;
+	_mem_sig_len[i] = mem_snap_format(_mem_sig_buf[i], MEM_SIG_BUF, 0,
+	    MEM_WM_SIGNAL);
+	__sync_synchronize();
+	_mem_sig_cur = i;
+	_mem_sig_t0 = mem_nsec();
+	return;
+}
+
+/*
+ * The mem_signal() handler, only write()s what mem_sig_refresh()
+ * formatted and so is async-signal-safe.
+ */
+static void
+mem_sig_handler(sig)
+	int	sig;
+{
+	const char *p;
+	ssize_t n;
+	size_t len;
+	int save, i;
+
+	save = errno;
+	i = _mem_sig_cur;		/* Read once, it may flip under us */
+	p = _mem_sig_buf[i];
+	len = _mem_sig_len[i];
+	while (len > 0) {
+		if ((n = write(_mem_sig_fd, p, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		p += n;
+		len -= n;
+	}
+	errno = save;
+	return;
+}
+
+/*
+ * Refresh what is read from outside the process, the exported
+ * counters and the signal snapshot, when due.  Called with the lock
+ * held.
+ */
+static void
+mem_publish()
+{
+	u_int64_t now;
+
+	if (getpid() != _mem_pid)
+		mem_fork_reset();
+	now = mem_nsec();
+	if (_mem_shm != NULL && now - _mem_shm_t0 >= _mem_shm_ival)
+		mem_shm_publish();
+	if (_mem_sig_ival != 0 && now - _mem_sig_t0 >= _mem_sig_ival)
+		mem_sig_refresh();
+	return;
+}
+
+/*
+ * State a fork() child must not share with its parent: the exported
+ * counters are named after the parent's pid and the reporter thread
+ * did not follow.  Records of live blocks stay, the child has the
+ * same blocks.
+ */
+static void
+mem_fork_reset()
+{
+
+	if (_mem_shm != NULL) {
+		munmap(_mem_shm, sizeof(*_mem_shm));
+		_mem_shm = NULL;
+	}
+	mem_pm_detach();
+	_mem_pid = getpid();
+	return;
+}
+
+/*
+ * Create the MEM_WATCH_FILE file `path' (layout in mem_pm.h), map it
+ * shared and set up the record pool in it.  The records then cost the
+ * same to update as in anonymous memory, and the kernel writes them
+ * back whenever the process stops, crash or not.
+ */
+static int
+mem_pm_open(path)
+	const	char *path;
+{
+	struct mem_pm_hdr *ph;
+	size_t off, pool;
+	u_char *p;
+	int fd;
+
+	off = (sizeof(*ph) + MEM_SITES * sizeof(struct mem_pm_site) +
+	    MEM_PM_STRS + 63) & ~(size_t)63;
+	pool = mpool_memsz(MAX_MEMALLOC_POOL, sizeof(struct mem_chunk));
+	if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0)
+		return (-1);
+	if (ftruncate(fd, off + pool) < 0 ||
+	    (p = mmap(NULL, off + pool, PROT_READ | PROT_WRITE, MAP_SHARED,
+	    fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return (-1);
+	}
+	close(fd);
+	snprintf(_mem_pm_path, sizeof(_mem_pm_path), "%s", path);
+	if (mpool_init_mem(&_mem_pool, "watchdog_mem", MAX_MEMALLOC_POOL,
+	    sizeof(struct mem_chunk), p + off, pool) < 0) {
+		munmap(p, off + pool);
+		return (-1);
+	}
+	ph = (struct mem_pm_hdr *)p;
+	ph->ph_version	= MEM_PM_VERSION;
+	ph->ph_pid	= getpid();
+	ph->ph_state	= MEM_PM_RUNNING;
+	ph->ph_started	= time(NULL);
+	ph->ph_len	= off + pool;
+	ph->ph_sites	= sizeof(*ph);
+	ph->ph_nsites	= MEM_SITES;
+	ph->ph_strs	= ph->ph_sites + MEM_SITES * sizeof(struct mem_pm_site);
+	ph->ph_strsz	= MEM_PM_STRS;
+	ph->ph_strused	= 1;		/* Offset 0 is no name */
+	ph->ph_bmap	= _mem_pool->mp_bmap - p;
+	ph->ph_base	= _mem_pool->mp_base - p;
+	ph->ph_nobjs	= _mem_pool->mp_nobjs;
+	ph->ph_rsiz	= _mem_pool->mp_rsiz;
+	ph->ph_osid	= offsetof(struct mem_chunk, mc_sid);
+	ph->ph_osize	= offsetof(struct mem_chunk, mc_size);
+	ph->ph_optr	= offsetof(struct mem_chunk, mc_p);
+	ph->ph_oseq	= offsetof(struct mem_chunk, mc_seq);
+	ph->ph_epoch_seq = 0;
+	__sync_synchronize();
+	ph->ph_magic	= MEM_PM_MAGIC;
+	_mem_pm = ph;
+	_mem_pm_len = off + pool;
+	return (0);
+}
+
+/*
+ * Name site `id' in the MEM_WATCH_FILE file.  Names that no longer fit
+ * are left out, mwpm shows the site as unknown.
+ */
+static void
+mem_pm_site(id, file, line, type)
+	u_int	id;
+	const	char *file;
+	int	line;
+	int	type;
+{
+	struct mem_pm_site *ps;
+	size_t len;
+	u_int off;
+
+	ps = (struct mem_pm_site *)((char *)_mem_pm + _mem_pm->ph_sites) + id;
+	ps->ps_line = line;
+	ps->ps_type = type;
+	len = strlen(file) + 1;
+	if (_mem_pm->ph_strused + len > _mem_pm->ph_strsz ||
+	    (off = __sync_fetch_and_add(&_mem_pm->ph_strused, len)) + len >
+	    _mem_pm->ph_strsz)
+		return;
+	memcpy((char *)_mem_pm + _mem_pm->ph_strs + off, file, len);
+	__sync_synchronize();
+	ps->ps_file = off;
+	return;
+}
+
+/*
+ * In a fork() child, move the records to a file of its own,
+ * MEM_WATCH_FILE.<pid>, mapped at the same address so the pool
+ * pointers stay good, and the child does not write over the records
+ * of its parent.  If that file cannot be made the child keeps a
+ * private copy in anonymous memory instead.
+ */
+static void
+mem_pm_detach()
+{
+	char path[sizeof(_mem_pm_path) + 16];
+	size_t off;
+	ssize_t n;
+	void *tmp;
+	int fd;
+
+	if (_mem_pm == NULL)
+		return;
+	snprintf(path, sizeof(path), "%s.%d", _mem_pm_path, (int)getpid());
+	if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600)) >= 0) {
+		for (off = 0; off < _mem_pm_len; off += n)
+			if ((n = write(fd, (char *)_mem_pm + off,
+			    _mem_pm_len - off)) <= 0)
+				break;
+		if (off == _mem_pm_len && mmap(_mem_pm, _mem_pm_len,
+		    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) !=
+		    MAP_FAILED) {
+			close(fd);
+			_mem_pm->ph_pid = getpid();
+			_mem_pm->ph_started = time(NULL);
+			return;
+		}
+		close(fd);
+		unlink(path);
+	}
+	if ((tmp = mmap(NULL, _mem_pm_len, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANON, -1, 0)) == MAP_FAILED) {
+		MLOG(("mem_pm_detach: out of memory, child shares the "
+		    "records file\n"));
+		return;
+	}
+	memcpy(tmp, _mem_pm, _mem_pm_len);
+	if (mmap(_mem_pm, _mem_pm_len, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANON | MAP_FIXED, -1, 0) != MAP_FAILED)
+		memcpy(_mem_pm, tmp, _mem_pm_len);
+	munmap(tmp, _mem_pm_len);
+	_mem_pm = NULL;
+	return;
+}
+
+#if defined (MEM_THREADS)
+static void
+mem_lock_init()
+{
+	pthread_mutexattr_t ma;
+
+	pthread_mutexattr_init(&ma);
+	pthread_mutexattr_settype(&ma, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&_mem_lock, &ma);
+	pthread_mutexattr_destroy(&ma);
+	pthread_cond_init(&_mem_wm_cv, NULL);
+	pthread_mutex_init(&_mem_rpt_use, NULL);
+	pthread_mutex_init(&_mem_rpt_lock, NULL);
+	pthread_cond_init(&_mem_rpt_cv, NULL);
+	pthread_cond_init(&_mem_rpt_done, NULL);
+	return;
+}
+
+/*
+ * fork() handlers: no other thread is inside the tracker while the
+ * process forks, so the child never sees a hash chain, tree or pool
+ * bitmap half updated.  The child gets new locks, as it is not the
+ * thread that took the old ones.  The child of a threaded process may
+ * only do what a signal handler may until it execs, so its handler
+ * only stores; the rest waits for its first call to the tracker
+ * (mem_fork_setup()), which a fork() and exec() never make.
+ */
+static void
+mem_fork_prepare()
+{
+
+	MEM_LOCK();
+	return;
+}
+
+static void
+mem_fork_parent()
+{
+
+	MEM_UNLOCK();
+	return;
+}
+
+static void
+mem_fork_child()
+{
+
+#if defined (PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP)
+	_mem_lock = _mem_lock0;
+	_mem_rpt_use = _mem_mutex0;
+	_mem_rpt_lock = _mem_mutex0;
+	_mem_wm_cv = _mem_cond0;
+	_mem_rpt_cv = _mem_cond0;
+	_mem_rpt_done = _mem_cond0;
+#else
+	mem_lock_init();	/* No static initializer for the lock */
+#endif	/* PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP */
+	_mem_lock_depth = 0;
+	_mem_reporter = 0;
+	_mem_wm_pending = 0;
+	_mem_rpt_started = _mem_rpt_nthr = 0;
+	_mem_rpt_want = _mem_rpt_busy = 0;
+	_mem_forked = 1;
+	return;
+}
+
+/* First call to the tracker in a fork() child, with the lock held */
+static void
+mem_fork_setup()
+{
+	int t;
+
+	_mem_forked = 0;
+	mem_fork_reset();
+	/* The reporter did not survive, bring it back for whoever used it */
+	for (t = 0; t < _mem_ntags; t++)
+		if (_mem_tag[t].mt_cb != NULL)
+			break;
+	if (_mem_wm_bytes != 0 || _mem_wm_count != 0 || _mem_wm_growth != 0 ||
+	    _mem_sig_ival != 0 || t < _mem_ntags)
+		mem_reporter_start();
+	return;
+}
+#endif	/* MEM_THREADS */
+
+#if defined (MEM_THREADS)
+
+/*
+ * The reporter thread writes watermark snapshots and keeps the
+ * exported counters up to date.
+ */
+static void *
+mem_reporter_thread(arg)
+	void	*arg;
+{
+	struct timespec ts;
+	u_int64_t ns, ival;
+	int why;
+
+	MEM_LOCK();
+	for (;;) {
+		while (_mem_wm_pending == 0) {
+			ival = _mem_shm != NULL ? _mem_shm_ival : 0;
+			if (_mem_sig_ival != 0 &&
+			    (ival == 0 || _mem_sig_ival < ival))
+				ival = _mem_sig_ival;
+			if (ival == 0) {
+				pthread_cond_wait(&_mem_wm_cv, &_mem_lock);
+				continue;
+			}
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ns = (u_int64_t)ts.tv_nsec + ival;
+			ts.tv_sec += ns / 1000000000;
+			ts.tv_nsec = ns % 1000000000;
+			if (pthread_cond_timedwait(&_mem_wm_cv, &_mem_lock,
+			    &ts) != 0)
+				mem_publish();
+		}
+		why = _mem_wm_pending;
+		_mem_wm_pending = 0;
+		MEM_UNLOCK();
+		if ((why & MEM_WM_TAGS) != 0)
+			mem_tag_fire();
+		if ((why &= ~MEM_WM_TAGS) != 0)
+			mem_wm_snapshot(why);
+		MEM_LOCK();
+	}
+	/* NOTREACHED */
+	return (arg);
+}
+
+/*
+ * Merge the tag and cost counters of an exiting thread and give its
+ * slot back, folding the filter count into slot 0.
+ */
+static void
+mem_thr_exit(arg)
+	void	*arg;
+{
+	struct mem_thr *th;
+	int t;
+
+	th = arg;
+	MEM_LOCK();
+	for (t = 0; t < _mem_ntags; t++)
+		if (th->th_tag_db[t] != 0 || th->th_tag_dc[t] != 0)
+			mem_tag_merge(t, th);
+	mem_self_exit();
+	if (th != &_mem_thr[0]) {
+		__sync_fetch_and_add(&_mem_thr[0].th_nrej, th->th_nrej);
+		th->th_nrej = 0;
+		__sync_synchronize();
+		th->th_used = 0;
+	}
+	_mem_thr_cur = NULL;
+	MEM_UNLOCK();
+	return;
+}
+
+/* Start the reporter thread if not yet running, with the lock held */
+static void
+mem_reporter_start()
+{
+	pthread_t tid;
+
+	if (_mem_reporter == 0 &&
+	    pthread_create(&tid, NULL, mem_reporter_thread, NULL) == 0) {
+		pthread_detach(tid);
+		_mem_reporter = 1;
+	}
+	return;
+}
+
+/*
+ * mem_report() worker thread: takes a partial table for each report
+ * and fills it in with the other threads.
+ */
+static void *
+mem_rpt_thread(arg)
+	void	*arg;
+{
+	struct mem_rpt *rp;
+
+	pthread_mutex_lock(&_mem_rpt_lock);
+	for (;;) {
+		while (_mem_rpt_want == 0)
+			pthread_cond_wait(&_mem_rpt_cv, &_mem_rpt_lock);
+		--_mem_rpt_want;
+		rp = &_mem_rpt[_mem_rpt_claim++];
+		pthread_mutex_unlock(&_mem_rpt_lock);
+		mem_rpt_worker(rp);
+		pthread_mutex_lock(&_mem_rpt_lock);
+		if (--_mem_rpt_busy == 0)
+			pthread_cond_signal(&_mem_rpt_done);
+	}
+	/* NOTREACHED */
+	return (arg);
+}
+
+/*
+ * Start the mem_report() workers once, one less than the processors
+ * (the caller walks too), with the lock held.  Only mem_report() does,
+ * a process that never asks for a report never runs them.
+ */
+static void
+mem_rpt_start()
+{
+	pthread_t tid;
+	long ncpu;
+	int n;
+
+	if (_mem_rpt_started)
+		return;
+	_mem_rpt_started = 1;
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	n = ncpu < 1 ? 1 : ncpu > MEM_REPORT_THREADS ?
+	    MEM_REPORT_THREADS : ncpu;
+	while (_mem_rpt_nthr < n - 1 &&
+	    pthread_create(&tid, NULL, mem_rpt_thread, NULL) == 0) {
+		pthread_detach(tid);
+		++_mem_rpt_nthr;
+	}
+	return;
+}
+
+#endif	/* MEM_THREADS */
+
+#if defined (MEM_SCAN)
+
+/*
+ * Conservative leak scan, in the spirit of a garbage collector's mark
+ * phase: the stacks, the writable segments of all loaded objects and
+ * the registered roots are scanned for words that point into (or to)
+ * a live block; every block reached is scanned in turn.  Blocks that
+ * are never reached are leaks.  Pointers held only in the registers
+ * of other threads, or in memory not tracked by mem_watch, are not
+ * seen.
+ */
+
+/* Live block, the spans are in address order for binary search */
+struct mem_span {
+	u_long	ms_lo;
+	u_long	ms_hi;
+	struct	mem_chunk *ms_m;
+};
+
+/* Stack of ranges waiting to be scanned */
+struct mem_rstack {
+	struct	mem_range *rs_r;
+	int	rs_n;
+	int	rs_max;
+};
+
+struct mem_scan {
+	struct	mem_span *sc_span;	/* Live blocks by address */
+	int	sc_nspan;
+	u_char	*sc_mark;		/* Block reached */
+	u_long	sc_lo;			/* Lowest and highest live byte */
+	u_long	sc_hi;
+	struct	mem_rstack sc_roots;
+	struct	mem_range sc_skip[2];	/* Not roots: the tracker's own */
+	int	sc_nskip;
+	int	sc_next;		/* Next root to hand out */
+	int	sc_fail;		/* Out of memory while scanning */
+#if defined (MEM_THREADS)
+	pthread_mutex_t	sc_lock;	/* Protects sc_shared, sc_idle */
+	pthread_cond_t	sc_cv;
+	struct	mem_rstack sc_shared;	/* Work given away by workers */
+	int	sc_idle;		/* Workers waiting for work */
+	int	sc_nthr;
+#endif	/* MEM_THREADS */
+};
+
+static int
+mem_rs_push(rs, lo, hi)
+	struct	mem_rstack *rs;
+	u_long	lo;
+	u_long	hi;
+{
+	struct mem_range *r;
+	int max;
+
+	if (rs->rs_n == rs->rs_max) {
+		max = rs->rs_max != 0 ? rs->rs_max * 2 : 1024;
+		if ((r = realloc(rs->rs_r, max * sizeof(*r))) == NULL)
+			return (-1);
+		rs->rs_r = r;
+		rs->rs_max = max;
+	}
+	rs->rs_r[rs->rs_n].mr_lo = lo;
+	rs->rs_r[rs->rs_n].mr_hi = hi;
+	++rs->rs_n;
+	return (0);
+}
+
+/* Push `lo'..`hi' cut in MEM_SCAN_CHUNK pieces so it can be shared */
+static int
+mem_rs_pushchunks(rs, lo, hi)
+	struct	mem_rstack *rs;
+	u_long	lo;
+	u_long	hi;
+{
+
+	for (; hi - lo > MEM_SCAN_CHUNK; lo += MEM_SCAN_CHUNK)
+		if (mem_rs_push(rs, lo, lo + MEM_SCAN_CHUNK) < 0)
+			return (-1);
+	return (lo < hi ? mem_rs_push(rs, lo, hi) : 0);
+}
+
+/* Push root `lo'..`hi' less the ranges in sc_skip */
+static void
+mem_scan_push(sc, lo, hi)
+	struct	mem_scan *sc;
+	u_long	lo;
+	u_long	hi;
+{
+	struct mem_range *r;
+	int i;
+
+	for (i = 0; i < sc->sc_nskip; i++) {
+		r = &sc->sc_skip[i];
+		if (r->mr_lo < hi && r->mr_hi > lo) {
+			mem_scan_push(sc, lo, r->mr_lo);
+			mem_scan_push(sc, r->mr_hi, hi);
+			return;
+		}
+	}
+	if (lo < hi && mem_rs_pushchunks(&sc->sc_roots, lo, hi) < 0)
+		sc->sc_fail = 1;
+	return;
+}
+
+/* Index of the block containing address `v', -1 if none */
+static int
+mem_span_find(sc, v)
+	struct	mem_scan *sc;
+	u_long	v;
+{
+	int lo, hi, mid;
+
+	lo = 0;
+	hi = sc->sc_nspan - 1;
+	while (lo < hi) {
+		mid = (lo + hi + 1) >> 1;
+		if (sc->sc_span[mid].ms_lo <= v)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	if (v >= sc->sc_span[lo].ms_lo && v < sc->sc_span[lo].ms_hi)
+		return (lo);
+	return (-1);
+}
+
+/*
+ * Blocks freed without telling mem_watch may be unmapped already,
+ * check large ones before touching them.
+ */
+static int
+mem_mapped(lo, hi)
+	u_long	lo;
+	u_long	hi;
+{
+	u_long pg;
+
+	if (hi - lo < 64 * 1024)
+		return (1);
+	pg = sysconf(_SC_PAGESIZE);
+	lo &= ~(pg - 1);
+	return (msync((void *)lo, hi - lo, MS_ASYNC) == 0);
+}
+
+static void
+mem_scan_range(sc, rs, lo, hi)
+	struct	mem_scan *sc;
+	struct	mem_rstack *rs;
+	u_long	lo;
+	u_long	hi;
+{
+	struct mem_span *sp;
+	u_long v;
+	int i;
+
+	lo = (lo + sizeof(u_long) - 1) & ~(sizeof(u_long) - 1);
+	for (; lo + sizeof(u_long) <= hi; lo += sizeof(u_long)) {
+		v = *(volatile u_long *)lo;
+		if (v < sc->sc_lo || v >= sc->sc_hi)
+			continue;
+		if ((i = mem_span_find(sc, v)) < 0 || sc->sc_mark[i] != 0 ||
+		    __sync_lock_test_and_set(&sc->sc_mark[i], 1) != 0)
+			continue;
+		sp = &sc->sc_span[i];
+		if (mem_mapped(sp->ms_lo, sp->ms_hi) &&
+		    mem_rs_pushchunks(rs, sp->ms_lo, sp->ms_hi) < 0)
+			sc->sc_fail = 1;
+	}
+	return;
+}
+
+#if defined (MEM_THREADS)
+
+/* Hand half of our work to idle workers */
+static void
+mem_scan_share(sc, rs)
+	struct	mem_scan *sc;
+	struct	mem_rstack *rs;
+{
+	int n;
+
+	if (rs->rs_n < 2 || *(volatile int *)&sc->sc_idle == 0)
+		return;
+	pthread_mutex_lock(&sc->sc_lock);
+	for (n = rs->rs_n / 2; n > 0; n--)
+		if (mem_rs_push(&sc->sc_shared, rs->rs_r[rs->rs_n - 1].mr_lo,
+		    rs->rs_r[rs->rs_n - 1].mr_hi) == 0)
+			--rs->rs_n;
+	pthread_cond_broadcast(&sc->sc_cv);
+	pthread_mutex_unlock(&sc->sc_lock);
+	return;
+}
+
+/*
+ * Wait for shared work, returns 0 when every worker is idle, that is
+ * the mark phase is over.
+ */
+static int
+mem_scan_steal(sc, rs)
+	struct	mem_scan *sc;
+	struct	mem_rstack *rs;
+{
+	struct mem_range *r;
+	int n;
+
+	pthread_mutex_lock(&sc->sc_lock);
+	++sc->sc_idle;
+	while (sc->sc_shared.rs_n == 0 && sc->sc_idle < sc->sc_nthr)
+		pthread_cond_wait(&sc->sc_cv, &sc->sc_lock);
+	if (sc->sc_shared.rs_n == 0) {
+		pthread_cond_broadcast(&sc->sc_cv);
+		pthread_mutex_unlock(&sc->sc_lock);
+		return (0);
+	}
+	--sc->sc_idle;
+	for (n = (sc->sc_shared.rs_n + 1) / 2; n > 0; n--) {
+		r = &sc->sc_shared.rs_r[sc->sc_shared.rs_n - 1];
+		if (mem_rs_push(rs, r->mr_lo, r->mr_hi) < 0)
+			break;
+		--sc->sc_shared.rs_n;
+	}
+	pthread_mutex_unlock(&sc->sc_lock);
+	return (1);
+}
+
+#endif	/* MEM_THREADS */
+
+static void *
+mem_scan_worker(arg)
+	void	*arg;
+{
+	struct mem_scan *sc = arg;
+	struct mem_rstack rs;
+	struct mem_range r;
+	int i;
+
+	memset(&rs, 0, sizeof(rs));
+	for (;;) {
+		if (rs.rs_n > 0)
+			r = rs.rs_r[--rs.rs_n];
+		else if ((i = __sync_fetch_and_add(&sc->sc_next, 1)) <
+		    sc->sc_roots.rs_n)
+			r = sc->sc_roots.rs_r[i];
+#if defined (MEM_THREADS)
+		else if (mem_scan_steal(sc, &rs))
+			continue;
+#endif	/* MEM_THREADS */
+		else
+			break;
+		mem_scan_range(sc, &rs, r.mr_lo, r.mr_hi);
+#if defined (MEM_THREADS)
+		mem_scan_share(sc, &rs);
+#endif	/* MEM_THREADS */
+	}
+	free(rs.rs_r);
+	return (NULL);
+}
+
+static int
+mem_scan_phdr(info, size, arg)
+	struct	dl_phdr_info *info;
+	size_t	size;
+	void	*arg;
+{
+	struct mem_scan *sc = arg;
+	u_long lo;
+	int i;
+
+	for (i = 0; i < info->dlpi_phnum; i++) {
+		if (info->dlpi_phdr[i].p_type != PT_LOAD ||
+		    (info->dlpi_phdr[i].p_flags & PF_W) == 0)
+			continue;
+		lo = info->dlpi_addr + info->dlpi_phdr[i].p_vaddr;
+		mem_scan_push(sc, lo, lo + info->dlpi_phdr[i].p_memsz);
+	}
+	return (0);
+}
+
+/*
+ * Collect the roots: the registers in `regs', the current stack from
+ * `sp' up, the writable segments and the registered ranges.  The stack
+ * below `sp' belongs to the scan itself, and _mem_lo holds the lowest
+ * block; neither is a root, or the blocks they point to would never
+ * be reported.  Stack and registered ranges are clipped to the
+ * readable mappings in /proc/self/maps.
+ */
+static void
+mem_scan_roots(sc, regs, sp)
+	struct	mem_scan *sc;
+	jmp_buf	*regs;
+	u_long	sp;
+{
+	struct mem_arena *a;
+	struct mem_arena_log *al;
+	FILE *fp;
+	char buf[512], prot[8];
+	u_long lo, hi, rlo, rhi;
+	int i;
+
+	if ((fp = fopen("/proc/self/maps", "r")) == NULL) {
+		sc->sc_fail = 1;
+		return;
+	}
+	sc->sc_skip[0].mr_lo = (u_long)&_mem_lo;
+	sc->sc_skip[0].mr_hi = (u_long)(&_mem_lo + 1);
+	sc->sc_nskip = 1;
+	while (fgets(buf, sizeof(buf), fp) != NULL)
+		if (sscanf(buf, "%lx-%lx", &lo, &hi) == 2 &&
+		    sp >= lo && sp < hi) {
+			sc->sc_skip[1].mr_lo = lo;
+			sc->sc_skip[1].mr_hi = sp;
+			sc->sc_nskip = 2;
+			break;
+		}
+	mem_scan_push(sc, (u_long)regs, (u_long)(regs + 1));
+	dl_iterate_phdr(mem_scan_phdr, sc);
+	rewind(fp);
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		if (sscanf(buf, "%lx-%lx %4s", &lo, &hi, prot) != 3 ||
+		    prot[0] != 'r')
+			continue;
+		if (sp >= lo && sp < hi)
+			mem_scan_push(sc, sp, hi);
+		for (i = 0; i < _mem_nroots; i++) {
+			rlo = _mem_roots[i].mr_lo > lo ?
+			    _mem_roots[i].mr_lo : lo;
+			rhi = _mem_roots[i].mr_hi < hi ?
+			    _mem_roots[i].mr_hi : hi;
+			mem_scan_push(sc, rlo, rhi);
+		}
+	}
+	fclose(fp);
+	/* Blocks of live arenas may point to tracked ones */
+	LIST_FOREACH(a, &_mem_arenas, ma_link)
+		for (al = a->ma_log; al != NULL; al = al->al_next)
+			for (i = 0; i < al->al_n; i++) {
+				lo = (u_long)al->al_blk[i].ab_p;
+				hi = lo + al->al_blk[i].ab_size;
+				mem_scan_push(sc, lo, hi);
+			}
+	return;
+}
+
+/*
+ * Mark every block reachable from the roots, see mem_scan_roots() for
+ * `regs' and `sp'.  Called with the lock held, returns -1 when out of
+ * memory.
+ */
+static int
+mem_scan(sc, regs, sp)
+	struct	mem_scan *sc;
+	jmp_buf	*regs;
+	u_long	sp;
+{
+	struct mem_chunk *m;
+	int i, n;
+#if defined (MEM_THREADS)
+	pthread_t tids[MEM_SCAN_THREADS];
+	long ncpu;
+#endif	/* MEM_THREADS */
+
+	memset(sc, 0, sizeof(*sc));
+	if ((sc->sc_span = malloc((_mem_pool->mp_nalloc + 1) *
+	    sizeof(struct mem_span))) == NULL ||
+	    (sc->sc_mark = calloc(_mem_pool->mp_nalloc + 1, 1)) == NULL)
+		goto fail;
+	n = 0;
+	RB_FOREACH(m, chunk_tree_t, &_mem_tree) {
+		sc->sc_span[n].ms_lo = (u_long)m->mc_p;
+		sc->sc_span[n].ms_hi = (u_long)m->mc_p +
+		    (m->mc_size > 0 ? m->mc_size : 1);
+		sc->sc_span[n].ms_m = m;
+		++n;
+	}
+	sc->sc_nspan = n;
+	if (n == 0)
+		return (0);
+	sc->sc_lo = sc->sc_span[0].ms_lo;
+	for (i = 0; i < n; i++)
+		if (sc->sc_span[i].ms_hi > sc->sc_hi)
+			sc->sc_hi = sc->sc_span[i].ms_hi;
+
+	mem_scan_roots(sc, regs, sp);
+	if (sc->sc_fail)
+		goto fail;
+
+#if defined (MEM_THREADS)
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	sc->sc_nthr = ncpu < 1 ? 1 : ncpu > MEM_SCAN_THREADS ?
+	    MEM_SCAN_THREADS : ncpu;
+	pthread_mutex_init(&sc->sc_lock, NULL);
+	pthread_cond_init(&sc->sc_cv, NULL);
+	for (n = 1; n < sc->sc_nthr; n++)
+		if (pthread_create(&tids[n], NULL, mem_scan_worker, sc) != 0)
+			break;
+	sc->sc_nthr = n;
+	mem_scan_worker(sc);
+	for (n = 1; n < sc->sc_nthr; n++)
+		pthread_join(tids[n], NULL);
+	pthread_mutex_destroy(&sc->sc_lock);
+	pthread_cond_destroy(&sc->sc_cv);
+	free(sc->sc_shared.rs_r);
+#else
+	mem_scan_worker(sc);
+#endif	/* MEM_THREADS */
+	if (sc->sc_fail)
+		goto fail;
+	return (0);
+fail:
+	free(sc->sc_roots.rs_r);
+	free(sc->sc_span);
+	free(sc->sc_mark);
+	return (-1);
+}
+
+#if defined (MEM_THREADS)
+
+/*
+ * Threads register their stack as a scan root the first time they
+ * add a record, and unregister it when they exit.
+ */
+static void
+mem_thread_stack()
+{
+	pthread_attr_t attr;
+	void *addr;
+	size_t len;
+
+	_mem_tstack = 1;
+	if (pthread_getattr_np(pthread_self(), &attr) != 0)
+		return;
+	if (pthread_attr_getstack(&attr, &addr, &len) == 0 &&
+	    mem_scan_root(addr, len) == 0)
+		pthread_setspecific(_mem_tkey, addr);
+	pthread_attr_destroy(&attr);
+	return;
+}
+
+static void
+mem_thread_exit(addr)
+	void	*addr;
+{
+
+	mem_scan_unroot(addr);
+	return;
+}
+
+#endif	/* MEM_THREADS */
+
+#endif	/* MEM_SCAN */
+
+/*
+ * mem_report() worker: adds up the live records by site into `arg', a
+ * struct mem_rpt, taking ranges of MEM_REPORT_STEP pool slots until
+ * all are done.  Records are visited in address order.  The caller
+ * holds the lock, so records only need reading.
+ */
+static void *
+mem_rpt_worker(arg)
+	void	*arg;
+{
+	struct mem_rpt *rp;
+	struct mem_chunk *m;
+	struct mpool_iter it;
+	int i;
+
+	rp = arg;
+	memset(rp, 0, sizeof(*rp));
+	for (;;) {
+#if defined (MEM_THREADS)
+		i = __sync_fetch_and_add(&_mem_rpt_next, MEM_REPORT_STEP);
+#else
+		i = _mem_rpt_next;
+		_mem_rpt_next += MEM_REPORT_STEP;
+#endif	/* MEM_THREADS */
+		if (i >= _mem_pool->mp_bmapsz)
+			break;
+		mpool_iter_init(&it, _mem_pool, i, i + MEM_REPORT_STEP);
+		while ((m = mpool_iter_next(&it)) != NULL) {
+			if (m->mc_seq < _mem_epoch_seq) {
+				++rp->rp_nold;
+				continue;
+			}
+			if (rp->rp_count[m->mc_sid]++ == 0 ||
+			    m->mc_stamp < rp->rp_oldest[m->mc_sid])
+				rp->rp_oldest[m->mc_sid] = m->mc_stamp;
+			rp->rp_bytes[m->mc_sid] += m->mc_size;
+		}
+	}
+	return (NULL);
+}
+
+/*
+ * Partition the site ids `id'[`lo', `hi') around a middle pivot, by
+ * `key' descending: [`lo', *`j'] are not below it, [*`i', `hi') not
+ * above.
+ */
+static void
+mem_rpt_part(id, lo, hi, key, i, j)
+	int	*id;
+	int	lo;
+	int	hi;
+	u_long	*key;
+	int	*i;
+	int	*j;
+{
+	u_long pivot;
+	int a, b, t;
+
+	pivot = key[id[lo + (hi - lo) / 2]];
+	a = lo;
+	b = hi - 1;
+	while (a <= b) {
+		while (key[id[a]] > pivot)
+			a++;
+		while (key[id[b]] < pivot)
+			b--;
+		if (a <= b) {
+			t = id[a];
+			id[a++] = id[b];
+			id[b--] = t;
+		}
+	}
+	*i = a;
+	*j = b;
+	return;
+}
+
+/* Move the `k' largest of `id'[`lo', `hi') by `key' to the front */
+static void
+mem_rpt_select(id, lo, hi, k, key)
+	int	*id;
+	int	lo;
+	int	hi;
+	int	k;
+	u_long	*key;
+{
+	int i, j;
+
+	while (hi - lo > 1) {
+		mem_rpt_part(id, lo, hi, key, &i, &j);
+		if (k <= j)
+			hi = j + 1;
+		else if (k >= i)
+			lo = i;
+		else
+			break;
+	}
+	return;
+}
+
+/* Sort `id'[`lo', `hi') by `key' descending, without allocating */
+static void
+mem_rpt_sort(id, lo, hi, key)
+	int	*id;
+	int	lo;
+	int	hi;
+	u_long	*key;
+{
+	int i, j;
+
+	while (hi - lo > 1) {
+		mem_rpt_part(id, lo, hi, key, &i, &j);
+		/* Recurse into the smaller side, the stack stays shallow */
+		if (j - lo < hi - i) {
+			mem_rpt_sort(id, lo, j + 1, key);
+			lo = i;
+		} else {
+			mem_rpt_sort(id, i, hi, key);
+			hi = j + 1;
+		}
+	}
+	return;
+}
+
+/* Write all of `buf' to `fd', 0 if it went */
+static int
+mem_write(fd, buf, len)
+	int	fd;
+	const	void *buf;
+	size_t	len;
+{
+	const char *p;
+	ssize_t w;
+
+	for (p = buf; len > 0; p += w, len -= w)
+		if ((w = write(fd, p, len)) < 0) {
+			if (errno != EINTR)
+				return (-1);
+			w = 0;
+		}
+	return (0);
+}
+
+/* Write the `n' buffers of `iov' to `fd', which are updated */
+static int
+mem_writev(fd, iov, n)
+	int	fd;
+	struct	iovec *iov;
+	int	n;
+{
+	ssize_t w;
+	int iv;
+
+	for (iv = 0; iv < n; ) {
+		if ((w = writev(fd, iov + iv, n - iv)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		for (; iv < n && (size_t)w >= iov[iv].iov_len; iv++)
+			w -= iov[iv].iov_len;
+		if (iv < n) {
+			iov[iv].iov_base = (char *)iov[iv].iov_base + w;
+			iov[iv].iov_len -= w;
+		}
+	}
+	return (0);
+}
+
+/* CRC-32 of gzip, `crc' being that of the data before `p' */
+static u_int
+mem_crc32(crc, p, len)
+	u_int	crc;
+	const	u_char *p;
+	size_t	len;
+{
+	u_int c;
+	int i, k;
+
+	if (_mem_crc_tab[1] == 0)
+		for (i = 0; i < 256; i++) {
+			for (c = i, k = 0; k < 8; k++)
+				c = c & 1 ? 0xedb88320U ^ (c >> 1) : c >> 1;
+			_mem_crc_tab[i] = c;
+		}
+	crc = ~crc;
+	while (len-- > 0)
+		crc = _mem_crc_tab[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return (~crc);
+}
+
+/* Append `v' at `p' as a protobuf varint, returns the end */
+static u_char *
+mem_pb_varint(p, v)
+	u_char	*p;
+	u_int64_t v;
+{
+
+	for (; v >= 0x80; v >>= 7)
+		*p++ = (u_char)v | 0x80;
+	*p++ = (u_char)v;
+	return (p);
+}
+
+/* Protobuf field `f', an integer */
+static u_char *
+mem_pb_uint(p, f, v)
+	u_char	*p;
+	int	f;
+	u_int64_t v;
+{
+
+	p = mem_pb_varint(p, (u_int64_t)f << 3);
+	return (mem_pb_varint(p, v));
+}
+
+/* Protobuf field `f', a string or message of `len' bytes */
+static u_char *
+mem_pb_bytes(p, f, buf, len)
+	u_char	*p;
+	int	f;
+	const	void *buf;
+	size_t	len;
+{
+
+	p = mem_pb_varint(p, (u_int64_t)f << 3 | 2);
+	p = mem_pb_varint(p, len);
+	memcpy(p, buf, len);
+	return (p + len);
+}
+
+/*
+ * Write the pf_off bytes of profile after the block header in
+ * _mem_rpt_buf as a stored deflate block, the last one if `final'.
+ */
+static void
+mem_pf_flush(pf, final)
+	struct	mem_pf *pf;
+	int	final;
+{
+	u_char *b;
+
+	b = (u_char *)_mem_rpt_buf;
+	b[0] = final ? 1 : 0;
+	b[1] = pf->pf_off & 0xff;
+	b[2] = pf->pf_off >> 8;
+	b[3] = ~b[1];
+	b[4] = ~b[2];
+	pf->pf_crc = mem_crc32(pf->pf_crc, b + 5, pf->pf_off);
+	pf->pf_isize += pf->pf_off;
+	if (pf->pf_err == 0 && mem_write(pf->pf_fd, b, pf->pf_off + 5) < 0)
+		pf->pf_err = 1;
+	pf->pf_off = 0;
+	return;
+}
+
+/*
+ * Start a new log piece for arena `a', called with the lock held.
+ */
+static struct mem_arena_log *
+mem_arena_log(a)
+	struct	mem_arena *a;
+{
+	struct mem_arena_log *al;
+
+	if ((al = _mem_arena_logs) != NULL)
+		_mem_arena_logs = al->al_next;
+	else if ((al = malloc(sizeof(*al))) == NULL)
+		return (NULL);
+	al->al_n = 0;
+	al->al_next = a->ma_log;
+	if (a->ma_log == NULL)
+		a->ma_first = al;
+	a->ma_log = al;
+	return (al);
+}
+
+/*
+ * List the arenas that were begun and not ended.  Called with the
+ * lock held.
+ */
+static void
+mem_arena_report()
+{
+	struct mem_arena *a;
+	int n;
+
+	n = 0;
+	LIST_FOREACH(a, &_mem_arenas, ma_link) {
+		MREPORT(("\tarena %s (%lu blocks, %lu bytes) begun at %s:%d\n",
+		    a->ma_name, a->ma_nblocks, a->ma_bytes,
+		    _mem_site[a->ma_sid].ms_file,
+		    _mem_site[a->ma_sid].ms_line));
+		++n;
+	}
+	if (n != 0)
+		MREPORT(("%d of %lu arenas not ended\n", n, _mem_arena_nbegun));
+	return;
+}
+
+/*
+ * `fn' at `sd' was handed a pointer the tracker has no record of.
+ * After tracking was switched on at run time this is expected, blocks
+ * allocated before are only counted; otherwise it is reported.
+ * May be called without the lock, the count is approximate then.
+ */
+static void
+mem_untracked(ptr, fn, sd)
+	void	*ptr;
+	const	char *fn;
+	struct	mem_sitedesc *sd;
+{
+
+	if (_mem_nepoch > 0) {
+		++_mem_nuntracked;
+		return;
+	}
+	MLOG(("%s: (%s:%d): 0x%lx: pointer not in hash\n", fn, sd->sd_file,
+	    sd->sd_line, (u_long)ptr));
+	return;
+}
+
+/*
+ * `fn' at `sd' frees or moves `ptr', which lies among the tracked
+ * blocks but has no record.  Returns non-zero if it may be given to
+ * the C library (see MEM_FOREIGN()), otherwise it has been reported
+ * and must be left alone.  Called with the lock held.
+ */
+static int
+mem_stray(ptr, fn, sd)
+	void	*ptr;
+	const	char *fn;
+	struct	mem_sitedesc *sd;
+{
+
+#if defined (MEM_QUARANTINE)
+	if (mem_quar_freed(ptr, fn, sd))
+		return (0);
+#endif	/* MEM_QUARANTINE */
+	mem_untracked(ptr, fn, sd);
+	if (MEM_LOOSE())
+		return (1);
+	if (_mem_nepoch > 0)
+		++_mem_nkept;
+	return (0);
+}
+
+/*
+ * Switch tracking on or off, with the lock held.  Switching it on
+ * starts a new epoch: reports leave out the blocks recorded before.
+ */
+static void
+mem_switch(on)
+	int	on;
+{
+
+	if (on && (_mem_on & ~MEM_ON_SWITCH) == 0) {
+		_mem_epoch_seq = _mem_seq;
+		++_mem_nepoch;
+		if (_mem_pm != NULL)
+			_mem_pm->ph_epoch_seq = _mem_epoch_seq;
+	}
+	if (!on)
+		_mem_loose = 1;
+	_mem_on = on;
+	return;
+}
+
+/* Ask for tracking to be toggled, see MEM_ON_SWITCH */
+static void
+mem_toggle_handler(sig)
+	int	sig;
+{
+
+	if (_mem_on & MEM_ON_SWITCH)
+		_mem_on_sig = !_mem_on_sig;
+	else
+		_mem_on_sig = !_mem_on;
+	_mem_on |= MEM_ON_SWITCH;
+	return;
+}
+
+/*
+ * Footnote of the block listings: `old' blocks were recorded before
+ * tracking was last switched on and not listed.  Called with the lock
+ * held.
+ */
+static void
+mem_epoch_report(old)
+	int	old;
+{
+
+	if (old != 0)
+		MREPORT(("%d blocks from before tracking was switched on "
+		    "not listed\n", old));
+	if (_mem_nuntracked != 0)
+		MREPORT(("%lu untracked blocks released\n",
+		    _mem_nuntracked - _mem_nkept));
+	if (_mem_nkept != 0)
+		MREPORT(("%lu untracked blocks among the tracked ones left "
+		    "allocated\n", _mem_nkept));
+	return;
+}
+
+/*
+ * External routines.
+ */
+
+void
+mem_alloc_notify(ptr, size, file, line)
+	void	*ptr;
+	size_t	size;
+	const	char *file;
+	int	line;
+{
+	struct mem_sitedesc sd;
+
+	if (MEM_OFF())
+		return;
+	MEM_SD_INIT(&sd, file, line, MEM_TYPE_ALLOC);
+	mem_alloc_notify_at(ptr, size, &sd);
+	return;
+}
+
+void
+mem_realloc_notify(ptr, size, file, line)
+	void	*ptr;
+	size_t	size;
+	const	char *file;
+	int	line;
+{
+	struct mem_sitedesc sd;
+
+	if (MEM_OFF())
+		return;
+	MEM_SD_INIT(&sd, file, line, MEM_TYPE_REALLOC);
+	mem_realloc_notify_at(ptr, size, &sd);
+	return;
+}
+
+void
+mem_free_notify(ptr, file, line)
+	void	*ptr;
+	const	char *file;
+	int	line;
+{
+	struct mem_sitedesc sd;
+
+	if (MEM_OFF_FREE(ptr))
+		return;
+	MEM_SD_INIT(&sd, file, line, MEM_TYPE_FREE);
+	mem_free_notify_at(ptr, &sd);
+	return;
+}
+
+void
+mem_alloc_notify_at(ptr, size, sd)
+	void	*ptr;
+	size_t	size;
+	struct	mem_sitedesc *sd;
+{
+	struct mem_chunk *m;
+	u_int64_t t0;
+
+	/* Don't even bother */
+	if (MEM_OFF())
+		return;
+
+	MEM_SELF_START(t0);
+	MEM_LOCK();
+	m = mem_chunk_get(ptr, "mem_alloc_notify", sd, MEM_TYPE_ALLOC);
+	if (m != NULL) {
+		m->mc_size	= size;
+		mem_site_alloc(m);
+		mem_chunk_link(m);
+	}
+	MEM_UNLOCK();
+	MEM_SELF_END(MEM_SELF_ALLOC, t0);
+	return;
+}
+
+void
+mem_realloc_notify_at(ptr, size, sd)
+	void	*ptr;
+	size_t	size;
+	struct	mem_sitedesc *sd;
+{
+	struct mem_chunk *m;
+	u_int64_t t0;
+
+	if (MEM_OFF())
+		return;
+
+	MEM_SELF_START(t0);
+	MEM_LOCK();
+	m = mem_chunk_get(ptr, "mem_realloc_notify", sd, MEM_TYPE_REALLOC);
+	if (m != NULL) {
+		m->mc_size	= size;
+		mem_site_alloc(m);
+		mem_chunk_link(m);
+	}
+	MEM_UNLOCK();
+	MEM_SELF_END(MEM_SELF_REALLOC, t0);
+	return;
+}
+
+void
+mem_free_notify_at(ptr, sd)
+	void	*ptr;
+	struct	mem_sitedesc *sd;
+{
+	struct mem_chunk *m;
+	u_int64_t t0;
+
+	if (MEM_UNKNOWN(ptr)) {
+		if (!MEM_OFF())
+			mem_untracked(ptr, "mem_free_notify", sd);
+		return;
+	}
+
+	MEM_SELF_START(t0);
+	MEM_LOCK();
+	if ((m = mem_chunk_unlink(ptr)) == NULL)
+		mem_untracked(ptr, "mem_free_notify", sd);
+	else {
+		mem_site_free(m);
+		mpool_reclaim(_mem_pool, m);
+	}
+	MEM_UNLOCK();
+	MEM_SELF_END(MEM_SELF_FREE, t0);
+	return;
+}
+
+/*
+ * Tracked allocator wrappers, see mem_watch.h.  Blocks get redzones
+ * only when a record could be had for them, so _mem_free() can always
+ * tell how a pointer was allocated.
+ */
+
+void *
+_mem_malloc(size, file, line)
+	size_t	size;
+	const	char *file;
+	int	line;
+{
+	struct mem_sitedesc sd;
+
+	if (MEM_OFF())
+		return (malloc(size));
+	MEM_SD_INIT(&sd, file, line, MEM_TYPE_ALLOC);
+	return (_mem_malloc_at(size, &sd));
+}
+
+void *
+_mem_calloc(nmemb, size, file, line)
+	size_t	nmemb;
+	size_t	size;
+	const	char *file;
+	int	line;
+{
+	struct mem_sitedesc sd;
+
+	if (MEM_OFF())
+		return (calloc(nmemb, size));
+	MEM_SD_INIT(&sd, file, line, MEM_TYPE_ALLOC);
+	return (_mem_calloc_at(nmemb, size, &sd));
+}
+
+void *
+_mem_realloc(ptr, size, file, line)
+	void	*ptr;
+	size_t	size;
+	const	char *file;
+	int	line;
+{
+	struct mem_sitedesc sd;
+
+	if (MEM_OFF_FREE(ptr))
+		return (realloc(ptr, size));
+	MEM_SD_INIT(&sd, file, line, MEM_TYPE_REALLOC);
+	return (_mem_realloc_at(ptr, size, &sd));
+}
+
+void
+_mem_free(ptr, file, line)
+	void	*ptr;
+	const	char *file;
+	int	line;
+{
+	struct mem_sitedesc sd;
+
+	if (MEM_OFF_FREE(ptr)) {
+		free(ptr);
+		return;
+	}
+	MEM_SD_INIT(&sd, file, line, MEM_TYPE_FREE);
+	_mem_free_at(ptr, &sd);
+	return;
+}
+
+void *
+_mem_malloc_at(size, sd)
+	size_t	size;
+	struct	mem_sitedesc *sd;
+{
+	u_int64_t t0;
+	void *p;
+
+	if (MEM_OFF())
+		return (malloc(size));
+	MEM_SELF_START(t0);
+	p = mem_alloc(size, sd, MEM_TYPE_ALLOC);
+	MEM_SELF_END(MEM_SELF_ALLOC, t0);
+	return (p);
+}
+
+/* Body of _mem_malloc_at(), also moves blocks for _mem_realloc_at() */
+static void *
+mem_alloc(size, sd, type)
+	size_t	size;
+	struct	mem_sitedesc *sd;
+	int	type;
+{
+	struct mem_chunk *m;
+	void *p;
+
+	MEM_LOCK();
+#if MEM_CHECK_INTERVAL > 0
+	if (++_mem_ncheck >= MEM_CHECK_INTERVAL) {
+		_mem_ncheck = 0;
+		mem_check();
+	}
+#endif	/* MEM_CHECK_INTERVAL */
+	if ((m = mem_chunk_get(NULL, "_mem_malloc", sd, type)) == NULL) {
+		MEM_UNLOCK();
+		return (malloc(size));
+	}
+	m->mc_size	= size;
+#if defined (MEM_REDZONE)
+	m->mc_flags	= mem_guarded(size, sd->sd_file, sd->sd_line) ?
+	    MEM_FLAG_GUARD : MEM_FLAG_REDZONE;
+	p = mem_rz_alloc(size, m->mc_flags);
+#else
+	p = malloc(size);
+#endif	/* MEM_REDZONE */
+	if (p == NULL)
+		mpool_reclaim(_mem_pool, m);
+	else {
+		m->mc_p		= p;
+		mem_site_alloc(m);
+		mem_chunk_link(m);
+	}
+	MEM_UNLOCK();
+	return (p);
+}
+
+void *
+_mem_calloc_at(nmemb, size, sd)
+	size_t	nmemb;
+	size_t	size;
+	struct	mem_sitedesc *sd;
+{
+	void *p;
+
+	if (MEM_OFF())
+		return (calloc(nmemb, size));
+	if (size != 0 && nmemb > (size_t)-1 / size)
+		return (NULL);
+	if ((p = _mem_malloc_at(nmemb * size, sd)) != NULL)
+		memset(p, 0, nmemb * size);
+	return (p);
+}
+
+void *
+_mem_realloc_at(ptr, size, sd)
+	void	*ptr;
+	size_t	size;
+	struct	mem_sitedesc *sd;
+{
+	struct mem_chunk *m;
+	u_int64_t t0;
+	void *p;
+
+	if (ptr == NULL)
+		return (_mem_malloc_at(size, sd));
+	/* realloc(ptr, 0) may free `ptr' and return NULL: make it a free */
+	if (size == 0) {
+		_mem_free_at(ptr, sd);
+		return (NULL);
+	}
+	if (MEM_FOREIGN(ptr)) {
+		if (MEM_OFF())
+			return (realloc(ptr, size));
+		mem_untracked(ptr, "_mem_realloc", sd);
+		if ((p = realloc(ptr, size)) != NULL)
+			mem_realloc_notify_at(p, size, sd);
+		return (p);
+	}
+
+	/* Tracked blocks are moved by the tracker even when it is off */
+	MEM_SELF_START(t0);
+	MEM_LOCK();
+	if ((m = mem_chunk_unlink(ptr)) == NULL) {
+		if (!mem_stray(ptr, "_mem_realloc", sd)) {
+			MEM_UNLOCK();
+			return (NULL);
+		}
+		if ((p = realloc(ptr, size)) != NULL)
+			mem_realloc_notify_at(p, size, sd);
+		MEM_UNLOCK();
+		return (p);
+	}
+#if !defined (MEM_QUARANTINE)
+	if (m->mc_flags == 0) {
+		if ((p = realloc(ptr, size)) != NULL) {
+			/* The old block ends here as far as sites go */
+			mem_site_free(m);
+			m->mc_sid	= MEM_SD_ID(sd, MEM_TYPE_REALLOC);
+			m->mc_size	= size;
+			m->mc_p		= p;
+			mem_site_alloc(m);
+		}
+		mem_chunk_link(m);
+		MEM_UNLOCK();
+		MEM_SELF_END(MEM_SELF_REALLOC, t0);
+		return (p);
+	}
+#endif	/* !MEM_QUARANTINE */
+	/* Redzoned and quarantined blocks always move */
+	mem_chunk_link(m);
+	if ((p = mem_alloc(size, sd, MEM_TYPE_REALLOC)) != NULL) {
+		memcpy(p, ptr, (size_t)m->mc_size < size ?
+		    (size_t)m->mc_size : size);
+		_mem_free_at(ptr, sd);
+	}
+	MEM_UNLOCK();
+	MEM_SELF_END(MEM_SELF_REALLOC, t0);
+	return (p);
+}
+
+void
+_mem_free_at(ptr, sd)
+	void	*ptr;
+	struct	mem_sitedesc *sd;
+{
+
+	mem_dealloc(ptr, (size_t)-1, sd);
+	return;
+}
+
+/*
+ * Free of a block the caller knows the size of, e.g. by C++ sized
+ * delete.  A size other than the one allocated is reported, it
+ * usually means deleting through a pointer to the wrong type.
+ */
+void
+_mem_free_sized_at(ptr, size, sd)
+	void	*ptr;
+	size_t	size;
+	struct	mem_sitedesc *sd;
+{
+
+	mem_dealloc(ptr, size, sd);
+	return;
+}
+
+/*
+ * Allocation aligned to `align', a power of two.  Alignments the
+ * redzone layout does not keep are had from posix_memalign() and
+ * tracked without redzones.
+ */
+void *
+_mem_memalign_at(align, size, sd)
+	size_t	align;
+	size_t	size;
+	struct	mem_sitedesc *sd;
+{
+	void *p;
+
+	if (align <= MEM_GUARD_ALIGN && !MEM_OFF())
+		return (_mem_malloc_at(size, sd));
+	if (posix_memalign(&p, align, size) != 0)
+		return (NULL);
+	mem_alloc_notify_at(p, size, sd);
+	return (p);
+}
+
+/* Body of _mem_free_at(), `size' is (size_t)-1 when not known */
+static void
+mem_dealloc(ptr, size, sd)
+	void	*ptr;
+	size_t	size;
+	struct	mem_sitedesc *sd;
+{
+	struct mem_chunk *m;
+	u_int64_t t0;
+
+	if (MEM_FOREIGN(ptr)) {
+		if (!MEM_OFF() && ptr != NULL)
+			mem_untracked(ptr, "_mem_free", sd);
+		free(ptr);
+		return;
+	}
+
+	/* Tracked blocks are released by the tracker even when it is off */
+	MEM_SELF_START(t0);
+	MEM_LOCK();
+	if ((m = mem_chunk_unlink(ptr)) == NULL) {
+		if (mem_stray(ptr, "_mem_free", sd))
+			free(ptr);
+		MEM_UNLOCK();
+		return;
+	}
+	if (size != (size_t)-1 && size != (size_t)m->mc_size)
+		MLOG(("_mem_free: (%s:%d): 0x%lx: freed as %lu bytes, "
+		    "allocated %d bytes at %s:%d\n", sd->sd_file, sd->sd_line,
+		    (u_long)ptr, (u_long)size, m->mc_size,
+		    MEM_SITE(m)->ms_file, MEM_SITE(m)->ms_line));
+#if defined (MEM_REDZONE)
+	if (m->mc_flags != 0)
+		mem_rz_check(m, "_mem_free", sd->sd_file, sd->sd_line);
+#endif	/* MEM_REDZONE */
+	mem_site_free(m);
+#if defined (MEM_QUARANTINE)
+	mem_quar_put(m, sd);
+#else
+	mem_release(ptr, m->mc_size, m->mc_flags);
+#endif	/* MEM_QUARANTINE */
+	mpool_reclaim(_mem_pool, m);
+	MEM_UNLOCK();
+	MEM_SELF_END(MEM_SELF_FREE, t0);
+	return;
+}
+
+/*
+ * Arenas, for blocks that are all freed together (per request
+ * allocations and the like.)  Blocks given to mem_arena_alloc() are
+ * only appended to the arena's log, they get no record of their own;
+ * mem_arena_end() drops the log as a whole.  Arenas still live are
+ * listed by mem_stats() and mem_leaks() and their blocks are scanned
+ * for pointers.  An arena must be used by one thread at a time.
+ */
+struct mem_arena *
+_mem_arena_begin(name, file, line)
+	const	char *name;
+	const	char *file;
+	int	line;
+{
+	struct mem_arena *a;
+
+	if (MEM_OFF())
+		return (NULL);
+
+	MEM_LOCK();
+	if ((a = LIST_FIRST(&_mem_arena_free)) != NULL)
+		LIST_REMOVE(a, ma_link);
+	else if ((a = malloc(sizeof(*a))) == NULL) {
+		MLOG(("mem_arena_begin: (%s:%d): out of memory\n",
+		    file, line));
+		MEM_UNLOCK();
+		return (NULL);
+	}
+	a->ma_name	= name != NULL ? name : "(anonymous)";
+	a->ma_sid	= mem_site_id(file, line, MEM_TYPE_ALLOC);
+	a->ma_nblocks	= 0;
+	a->ma_bytes	= 0;
+	a->ma_log	= NULL;
+	a->ma_first	= NULL;
+	LIST_INSERT_HEAD(&_mem_arenas, a, ma_link);
+	++_mem_arena_nbegun;
+	MEM_UNLOCK();
+	return (a);
+}
+
+void
+mem_arena_alloc(a, ptr, size)
+	struct	mem_arena *a;
+	void	*ptr;
+	size_t	size;
+{
+	struct mem_arena_log *al;
+
+	if (a == NULL)
+		return;
+	if ((al = a->ma_log) == NULL || al->al_n == MEM_ARENA_LOG) {
+		MEM_LOCK();
+		al = mem_arena_log(a);
+		MEM_UNLOCK();
+		if (al == NULL)
+			return;
+	}
+	al->al_blk[al->al_n].ab_p	= ptr;
+	al->al_blk[al->al_n].ab_size	= size;
+	++al->al_n;
+	++a->ma_nblocks;
+	a->ma_bytes += size;
+	return;
+}
+
+void
+mem_arena_end(a)
+	struct	mem_arena *a;
+{
+
+	if (a == NULL)
+		return;
+
+	MEM_LOCK();
+	LIST_REMOVE(a, ma_link);
+	if (a->ma_log != NULL) {
+		a->ma_first->al_next = _mem_arena_logs;
+		_mem_arena_logs = a->ma_log;
+	}
+	LIST_INSERT_HEAD(&_mem_arena_free, a, ma_link);
+	MEM_UNLOCK();
+	return;
+}
+
+/*
+ * Verify the redzones of every live block and the poison of every
+ * quarantined one, returns the number of corrupted blocks.
+ */
+int
+mem_check()
+{
+	int nbad;
+#if defined (MEM_REDZONE) || defined (MEM_QUARANTINE)
+	int i;
+#endif	/* MEM_REDZONE || MEM_QUARANTINE */
+#if defined (MEM_REDZONE)
+	struct mem_chunk *m;
+#endif	/* MEM_REDZONE */
+
+	nbad = 0;
+	if (_mem_init == 0)
+		return (0);
+	MEM_LOCK();
+#if defined (MEM_REDZONE)
+	for (i = 0; i < HASH_SIZE; i++)
+		TAILQ_FOREACH(m, &_mem_hash[i], mc_link)
+			if (m->mc_flags != 0 &&
+			    mem_rz_check(m, "mem_check", NULL, 0))
+				++nbad;
+#endif	/* MEM_REDZONE */
+#if defined (MEM_QUARANTINE)
+	for (i = 0; i < _mem_qlen; i++)
+		nbad += mem_quar_check(&_mem_quar[(_mem_qhead + i) %
+		    MEM_QUAR_FREES], "mem_check");
+#endif	/* MEM_QUARANTINE */
+	MEM_UNLOCK();
+	return (nbad);
+}
+
+/*
+ * Limit the quarantine to `maxbytes' bytes and `maxfrees' blocks (at
+ * most MEM_QUAR_FREES), releasing the oldest blocks over the limits.
+ * Returns -1 when built without MEM_QUARANTINE.
+ */
+int
+mem_quarantine(maxbytes, maxfrees)
+	size_t	maxbytes;
+	int	maxfrees;
+{
+
+#if defined (MEM_QUARANTINE)
+	if (maxfrees < 0 || maxfrees > MEM_QUAR_FREES)
+		maxfrees = MEM_QUAR_FREES;
+	MEM_LOCK();
+	_mem_qmaxbytes = maxbytes;
+	_mem_qmaxfrees = maxfrees;
+	while (_mem_qlen > 0 && (_mem_qlen > _mem_qmaxfrees ||
+	    _mem_qbytes > _mem_qmaxbytes))
+		mem_quar_pop();
+	MEM_UNLOCK();
+	return (0);
+#else
+	return (-1);
+#endif	/* MEM_QUARANTINE */
+}
+
+/*
+ * Electric fence style guard pages for blocks of `lo'..`hi' bytes, or
+ * for blocks allocated at `file':`line' (any line when 0.)  The file
+ * name is compared as given by __FILE__ and is not copied.
+ */
+int
+mem_guard_size(lo, hi)
+	size_t	lo;
+	size_t	hi;
+{
+
+	MEM_LOCK();
+	if (_mem_nguard >= MEM_GUARD_RULES) {
+		MEM_UNLOCK();
+		return (-1);
+	}
+	_mem_guard[_mem_nguard].mg_lo = lo;
+	_mem_guard[_mem_nguard].mg_hi = hi;
+	_mem_guard[_mem_nguard].mg_file = NULL;
+	++_mem_nguard;
+	MEM_UNLOCK();
+	return (0);
+}
+
+int
+mem_guard_site(file, line)
+	const	char *file;
+	int	line;
+{
+
+	if (file == NULL)
+		return (-1);
+	MEM_LOCK();
+	if (_mem_nguard >= MEM_GUARD_RULES) {
+		MEM_UNLOCK();
+		return (-1);
+	}
+	_mem_guard[_mem_nguard].mg_file = file;
+	_mem_guard[_mem_nguard].mg_line = line;
+	++_mem_nguard;
+	MEM_UNLOCK();
+	return (0);
+}
+
+/*
+ * Report the blocks that cannot be reached from the stacks, data
+ * segments and registered roots.  Returns the number of leaked blocks
+ * or -1 if the scan could not be done (always so without MEM_SCAN.)
+ */
+int
+mem_leaks()
+{
+#if defined (MEM_SCAN)
+	struct mem_scan sc;
+	struct mem_chunk *m;
+	jmp_buf regs;
+	u_long bytes;
+	int i, n, old;
+
+	/* The caller's registers, and its stack up from our frame */
+	setjmp(regs);
+	if (_mem_init == 0)
+		return (-1);
+
+	MEM_LOCK();
+	if (mem_scan(&sc, &regs, (u_long)__builtin_frame_address(0)) < 0) {
+		MLOG(("mem_leaks: out of memory\n"));
+		MEM_UNLOCK();
+		return (-1);
+	}
+	mem_log_flush();
+	MREPORT(("** Memory watchdog leaks:\n"));
+	MREPORT((">> memory pool:\n"));
+	mpool_stats();
+	bytes = 0;
+	old = 0;
+	for (i = n = 0; i < sc.sc_nspan; i++) {
+		if (sc.sc_mark[i] != 0)
+			continue;
+		m = sc.sc_span[i].ms_m;
+		if (m->mc_seq < _mem_epoch_seq) {
+			++old;
+			continue;
+		}
+		MREPORT(("\t%s (%d bytes) %s %d [0x%lx]\n",
+		    MEM_TYPE_NAME(MEM_SITE(m)->ms_type), m->mc_size,
+		    MEM_SITE(m)->ms_file, MEM_SITE(m)->ms_line,
+		    (u_long)m->mc_p));
+		bytes += m->mc_size;
+		++n;
+	}
+	MREPORT(("%d of %d blocks (%lu bytes) unreachable\n", n, sc.sc_nspan,
+	    bytes));
+	mem_epoch_report(old);
+	mem_arena_report();
+	MREPORT(("DONE\n"));
+	free(sc.sc_roots.rs_r);
+	free(sc.sc_span);
+	free(sc.sc_mark);
+	MEM_UNLOCK();
+	return (n);
+#else
+	return (-1);
+#endif	/* MEM_SCAN */
+}
+
+/*
+ * Register `len' bytes at `addr' as an additional root for the leak
+ * scan, e.g. memory of a foreign allocator holding tracked pointers.
+ * Parts that are not mapped when the scan runs are skipped.
+ */
+int
+mem_scan_root(addr, len)
+	void	*addr;
+	size_t	len;
+{
+	int error;
+
+	MEM_LOCK();
+	error = -1;
+	if (_mem_nroots < MEM_SCAN_ROOTS) {
+		_mem_roots[_mem_nroots].mr_lo = (u_long)addr;
+		_mem_roots[_mem_nroots].mr_hi = (u_long)addr + len;
+		++_mem_nroots;
+		error = 0;
+	}
+	MEM_UNLOCK();
+	return (error);
+}
+
+void
+mem_scan_unroot(addr)
+	void	*addr;
+{
+	int i;
+
+	MEM_LOCK();
+	for (i = 0; i < _mem_nroots; i++)
+		if (_mem_roots[i].mr_lo == (u_long)addr) {
+			_mem_roots[i] = _mem_roots[--_mem_nroots];
+			break;
+		}
+	MEM_UNLOCK();
+	return;
+}
+
+/*
+ * Find the live block containing `addr', which may point anywhere
+ * inside it.  Fills `mi' and returns 0, -1 if no block contains it.
+ */
+int
+mem_lookup(addr, mi)
+	const	void *addr;
+	struct	mem_info *mi;
+{
+	struct mem_chunk *m;
+	int error;
+
+	if (_mem_init == 0)
+		return (-1);
+
+	MEM_LOCK();
+	error = -1;
+	m = mem_chunk_below((u_long)addr);
+	if (m != NULL && (u_long)addr < (u_long)m->mc_p +
+	    (m->mc_size > 0 ? m->mc_size : 1)) {
+		mi->mi_p	= m->mc_p;
+		mi->mi_size	= m->mc_size;
+		mi->mi_file	= MEM_SITE(m)->ms_file;
+		mi->mi_line	= MEM_SITE(m)->ms_line;
+		mi->mi_age	= _mem_seq - m->mc_seq;
+		error = 0;
+	}
+	MEM_UNLOCK();
+	return (error);
+}
+
+/*
+ * Size and quality of the pointer filter.  The expected false positive
+ * rate is the fraction of counters in use to the MEM_BLOOM_K-th power,
+ * the measured one counts the lookups the hash had to answer no to.
+ */
+static void
+mem_bloom_stats()
+{
+	u_long i, nbytes, nused, nrej;
+	double fill, est, meas;
+	int k;
+
+	if (_mem_bloom == NULL)
+		return;
+	nrej = _mem_bloom_nrej;
+#if defined (MEM_THREADS)
+	for (k = 0; k < MEM_THR_SLOTS; k++)
+		nrej += _mem_thr[k].th_nrej;
+#endif	/* MEM_THREADS */
+	nbytes = (_mem_bloom_mask + 1) * MEM_BLOOM_LINE;
+	for (i = nused = 0; i < nbytes; i++)
+		nused += ((_mem_bloom[i] & 0xf) != 0) +
+		    ((_mem_bloom[i] & 0xf0) != 0);
+	fill = (double)nused / (nbytes * 2);
+	for (k = 0, est = 1; k < MEM_BLOOM_K; k++)
+		est *= fill;
+	meas = nrej + _mem_bloom_nfp == 0 ? 0 :
+	    (double)_mem_bloom_nfp / (nrej + _mem_bloom_nfp);
+	MREPORT(("%s: filter %lu bytes, %lu pointers, %.1f%% counters "
+	    "used, %lu saturated\n", _mem_pool->mp_label, nbytes,
+	    _mem_bloom_n, fill * 100, _mem_bloom_nsat));
+	MREPORT(("%s: filter rejected %lu, false positives %lu, rate "
+	    "%.3f%% (expected %.3f%%)\n", _mem_pool->mp_label,
+	    nrej, _mem_bloom_nfp, meas * 100, est * 100));
+	return;
+}
+
+void
+mpool_stats()
+{
+
+	mem_log_flush();
+
+	MREPORT(("%s: obj_siz=%d, max_objs=%d, bmap_siz=%d\n",
+	    _mem_pool->mp_label, _mem_pool->mp_rsiz, _mem_pool->mp_nobjs,
+	    _mem_pool->mp_bmapsz));
+	MREPORT(("max_bytes=%d, alloc_peek=%d\n", _mem_pool->mp_maxbytes,
+	    _mem_pool->mp_napeek));
+	MREPORT(("%s: allocated %d, alloc_req %d, alloc_fail %d\n",
+	    _mem_pool->mp_label, _mem_pool->mp_nalloc, _mem_pool->mp_areq,
+	    _mem_pool->mp_afail));
+	MREPORT(("%s: reclaim_req %d, reclaim_fail %d\n",
+	    _mem_pool->mp_label, _mem_pool->mp_rreq, _mem_pool->mp_rfail));
+	if (_mem_pool->mp_rlive != NULL)
+		MREPORT(("%s: committed %lu of %lu bytes, "
+		    "decommitted %d runs\n",
+		    _mem_pool->mp_label, (u_long)_mem_pool->mp_ncommit <<
+		    _mem_pool->mp_runshift, (u_long)_mem_pool->mp_mapsz,
+		    _mem_pool->mp_ndecommit));
+	mem_bloom_stats();
+	return;
+}
+
+/*
+ * Fill `sx' with what the tracker costs, see mem_watch.h.  The hash
+ * chains are walked for their lengths, which takes as long as a walk
+ * of the records.
+ */
+int
+mem_self(sx)
+	struct	mem_self_info *sx;
+{
+	static struct {
+		const	void *t_p;
+		size_t	t_len;
+	} tab[] = {
+		{ _mem_hash, sizeof(_mem_hash) },
+		{ _mem_site, sizeof(_mem_site) },
+		{ _mem_site_hash, sizeof(_mem_site_hash) },
+		{ _mem_tag, sizeof(_mem_tag) },
+		{ _mem_rpt, sizeof(_mem_rpt) },
+		{ _mem_rpt_buf, sizeof(_mem_rpt_buf) },
+		{ _mem_cost, sizeof(_mem_cost) },
+		{ _mem_thr, sizeof(_mem_thr) },
+	};
+	struct mem_cost *c;
+	struct mem_chunk *m;
+	struct mpool *mp;
+	size_t len;
+	u_long n;
+	int i, p, b;
+
+	if (_mem_init == 0)
+		return (-1);
+
+	MEM_LOCK();
+	memset(sx, 0, sizeof(*sx));
+#if defined (MEM_SELF_TSC)
+	sx->sx_cycles = 1;
+#endif	/* MEM_SELF_TSC */
+	for (i = 0; i < MEM_SELF_THREADS; i++) {
+		c = &_mem_cost[i];
+		for (p = 0; p < MEM_SELF_PATHS; p++) {
+			sx->sx_timed[p] += c->co_calls[p];
+			sx->sx_time[p] += c->co_time[p];
+			if (c->co_max[p] > sx->sx_max[p])
+				sx->sx_max[p] = c->co_max[p];
+			for (b = 0; b < MEM_SIZE_CLASSES; b++)
+				sx->sx_hist[p][b] += c->co_hist[p][b];
+		}
+	}
+
+	sx->sx_lookups = _mem_nlookup;
+	sx->sx_probes = _mem_nprobe;
+	sx->sx_maxprobe = _mem_maxprobe;
+	memcpy(sx->sx_probe_hist, _mem_probe_hist,
+	    sizeof(sx->sx_probe_hist));
+	sx->sx_buckets = HASH_SIZE;
+	for (i = 0; i < HASH_SIZE; i++) {
+		n = 0;
+		TAILQ_FOREACH(m, &_mem_hash[i], mc_link)
+			++n;
+		if (n == 0)
+			continue;
+		++sx->sx_bused;
+		sx->sx_records += n;
+		if (n > sx->sx_maxchain)
+			sx->sx_maxchain = n;
+	}
+	sx->sx_load = (double)sx->sx_records / HASH_SIZE;
+
+	mp = _mem_pool;
+	sx->sx_gets = mp->mp_areq;
+	sx->sx_scan = mp->mp_nscan;
+	sx->sx_maxscan = mp->mp_maxscan;
+
+	/* The pool, the pointer filter and the tables set aside */
+	len = mp->mp_rlive != NULL ? mp->mp_mapsz :
+	    (size_t)mp->mp_nobjs * mp->mp_rsiz;
+	sx->sx_mapped = len + mp->mp_maxbytes;
+	sx->sx_resident = mem_resident(mp->mp_base, len) +
+	    mem_resident(mp->mp_bmap, mp->mp_maxbytes);
+	if (_mem_bloom != NULL) {
+		len = (_mem_bloom_mask + 1) * MEM_BLOOM_LINE;
+		sx->sx_mapped += len;
+		sx->sx_resident += mem_resident(_mem_bloom, len);
+	}
+	for (i = 0; i < sizeof(tab) / sizeof(tab[0]); i++) {
+		sx->sx_mapped += tab[i].t_len;
+		sx->sx_resident += mem_resident(tab[i].t_p, tab[i].t_len);
+	}
+	MEM_UNLOCK();
+	return (0);
+}
+
+/*
+ * Print what every callsite allocated and how long its blocks lived
+ * before being freed.
+ */
+void
+mem_site_stats()
+{
+	struct mem_site *ms;
+	double tick, secs;
+	char p50[32], p90[32], p99[32], max[32];
+	int order[MEM_SITES];
+	int i, n, b;
+
+	if (_mem_init == 0)
+		return;
+
+	MEM_LOCK();
+	tick = mem_tick_ns();
+	secs = mem_uptime();
+	for (i = n = 0; i < MEM_SITES; i++)
+		if (_mem_site[i].ms_nalloc != 0)
+			order[n++] = i;
+	qsort(order, n, sizeof(int), mem_site_cmp);
+	mem_log_flush();
+	MREPORT(("** Memory watchdog callsites (%d, %d registered):\n", n,
+	    _mem_nsitedesc));
+	for (i = 0; i < n && i < MEM_SITE_TOP; i++) {
+		ms = &_mem_site[order[i]];
+		MREPORT(("\t%s:%d: %lu %ss (%.1f/s), %lu bytes, "
+		    "%lu live (%lu bytes)\n", ms->ms_file, ms->ms_line,
+		    ms->ms_nalloc, MEM_TYPE_NAME(ms->ms_type),
+		    ms->ms_nalloc / secs, ms->ms_bytes,
+		    ms->ms_nalloc - ms->ms_nfree,
+		    ms->ms_bytes - ms->ms_fbytes));
+		MREPORT(("\t\tsizes"));
+		for (b = 0; b < MEM_SIZE_CLASSES; b++) {
+			if (ms->ms_sizes[b] == 0)
+				continue;
+			if (b == 0)
+				MREPORT((" 0:%lu", ms->ms_sizes[b]));
+			else
+				MREPORT((" %lu-%lu:%lu", 1UL << (b - 1),
+				    (1UL << b) - 1, ms->ms_sizes[b]));
+		}
+		MREPORT(("\n"));
+		if (ms->ms_nfree == 0)
+			continue;
+		for (b = MEM_LT_BUCKETS - 1; ms->ms_life[b] == 0; b--)
+			;
+		MREPORT(("\t\tlifetime p50 %s, p90 %s, p99 %s, max %s\n",
+		    mem_fmt_ns(p50, sizeof(p50),
+		    mem_lt_quantile(ms, 0.50, tick)),
+		    mem_fmt_ns(p90, sizeof(p90),
+		    mem_lt_quantile(ms, 0.90, tick)),
+		    mem_fmt_ns(p99, sizeof(p99),
+		    mem_lt_quantile(ms, 0.99, tick)),
+		    mem_fmt_ns(max, sizeof(max), mem_lt_value(b) * tick)));
+	}
+	if (n > MEM_SITE_TOP)
+		MREPORT(("\t... %d more sites\n", n - MEM_SITE_TOP));
+	if (_mem_nsitelost != 0)
+		MREPORT(("%lu blocks not counted, increase MEM_SITES (%d)\n",
+		    _mem_nsitelost, MEM_SITES));
+	MREPORT(("DONE\n"));
+	MEM_UNLOCK();
+	return;
+}
+
+/*
+ * Query API for the callsite counters: fill `si' with the first site
+ * at or after slot `i' and return its slot, -1 if there is none.
+ * Iterate with: for (i = 0; (i = mem_site_next(i, &si)) >= 0; i++)
+ */
+int
+mem_site_next(i, si)
+	int	i;
+	struct	mem_site_info *si;
+{
+
+	if (_mem_init == 0 || i < 0)
+		return (-1);
+
+	MEM_LOCK();
+	for (; i < MEM_SITES; i++)
+		if (_mem_site[i].ms_nalloc != 0)
+			break;
+	if (i < MEM_SITES)
+		mem_site_fill(&_mem_site[i], si, mem_uptime());
+	else
+		i = -1;
+	MEM_UNLOCK();
+	return (i);
+}
+
+/*
+ * Counters of `file':`line', returns -1 if nothing was allocated
+ * there.
+ */
+int
+mem_site_find(file, line, si)
+	const	char *file;
+	int	line;
+	struct	mem_site_info *si;
+{
+	struct mem_site *ms;
+	int error;
+
+	if (_mem_init == 0)
+		return (-1);
+
+	MEM_LOCK();
+	error = -1;
+	for (ms = _mem_site; ms < &_mem_site[MEM_SITES]; ms++) {
+		if (ms->ms_nalloc == 0 || ms->ms_line != line ||
+		    (ms->ms_file != file && strcmp(ms->ms_file, file) != 0))
+			continue;
+		mem_site_fill(ms, si, mem_uptime());
+		error = 0;
+		break;
+	}
+	MEM_UNLOCK();
+	return (error);
+}
+
+/*
+ * Take a snapshot when live bytes reach `bytes', live blocks reach
+ * `count' or live bytes grow by `growth' within `ival_ms'
+ * milliseconds, 0 turns a trigger off.  Byte and block watermarks are
+ * raised after firing.  With MEM_THREADS the snapshot is written by a
+ * thread of its own.
+ */
+int
+mem_watermark(bytes, count, growth, ival_ms)
+	size_t	bytes;
+	unsigned long count;
+	size_t	growth;
+	int	ival_ms;
+{
+
+	if (_mem_init == 0 || (growth != 0 && ival_ms <= 0))
+		return (-1);
+
+	MEM_LOCK();
+#if defined (MEM_THREADS)
+	mem_reporter_start();
+#endif	/* MEM_THREADS */
+	_mem_wm_bytes	= bytes;
+	_mem_wm_count	= count;
+	_mem_wm_growth	= growth;
+	_mem_wm_ival	= (u_int64_t)ival_ms * 1000000;
+	_mem_wm_t0	= mem_nsec();
+	_mem_wm_b0	= _mem_lbytes;
+	_mem_wm_credit	= 0;
+	MEM_UNLOCK();
+	return (0);
+}
+
+/*
+ * Snapshots go to files named `prefix'.pid.N, or to stdout when
+ * `prefix' is NULL.
+ */
+int
+mem_watermark_file(prefix)
+	const	char *prefix;
+{
+	char *p;
+
+	p = NULL;
+	if (prefix != NULL && (p = strdup(prefix)) == NULL)
+		return (-1);
+	MEM_LOCK();
+	free(_mem_wm_prefix);
+	_mem_wm_prefix = p;
+	MEM_UNLOCK();
+	return (0);
+}
+
+/*
+ * Publish the counters in a shared memory segment (see mem_shm.h),
+ * updated every `ival_ms' milliseconds, for mwtop to show.  Without
+ * MEM_THREADS updates happen from the allocation path when due.
+ */
+int
+mem_shm_export(ival_ms)
+	int	ival_ms;
+{
+	struct mem_shm *sh;
+	char name[64];
+	int fd;
+
+	if (_mem_init == 0 || ival_ms <= 0)
+		return (-1);
+
+	MEM_LOCK();
+	if (_mem_shm == NULL) {
+		snprintf(name, sizeof(name), MEM_SHM_NAME, (int)getpid());
+		if ((fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC,
+		    0600)) < 0) {
+			MLOG(("mem_shm_export: %s: cannot create\n", name));
+			MEM_UNLOCK();
+			return (-1);
+		}
+		sh = MAP_FAILED;
+		if (ftruncate(fd, sizeof(*sh)) == 0)
+			sh = mmap(NULL, sizeof(*sh), PROT_READ | PROT_WRITE,
+			    MAP_SHARED, fd, 0);
+		close(fd);
+		if (sh == MAP_FAILED) {
+			shm_unlink(name);
+			MEM_UNLOCK();
+			return (-1);
+		}
+		sh->sh_magic	= MEM_SHM_MAGIC;
+		sh->sh_version	= MEM_SHM_VERSION;
+		sh->sh_pid	= (int)getpid();
+		_mem_shm = sh;
+	}
+	_mem_shm_ival = (u_int64_t)ival_ms * 1000000;
+	mem_shm_publish();
+	_mem_wm_credit = 0;
+#if defined (MEM_THREADS)
+	mem_reporter_start();
+	pthread_cond_signal(&_mem_wm_cv);
+#endif	/* MEM_THREADS */
+	MEM_UNLOCK();
+	return (0);
+}
+
+/* Write a snapshot now */
+void
+mem_snapshot()
+{
+
+	if (_mem_init == 0)
+		return;
+	mem_wm_snapshot(MEM_WM_USER);
+	return;
+}
+
+/*
+ * Have signal `sig' write a snapshot of the live memory to `fd', e.g.
+ * to dump a production process with kill -USR2.  The handler does no
+ * more than write(): snapshots are formatted ahead every `ival_ms'
+ * milliseconds, by the reporter thread with MEM_THREADS and while
+ * allocating otherwise.
+ */
+int
+mem_signal(sig, fd, ival_ms)
+	int	sig;
+	int	fd;
+	int	ival_ms;
+{
+	struct sigaction sa;
+
+	if (_mem_init == 0 || fd < 0 || ival_ms <= 0)
+		return (-1);
+
+	MEM_LOCK();
+	_mem_sig_fd = fd;
+	_mem_sig_ival = (u_int64_t)ival_ms * 1000000;
+	mem_sig_refresh();
+	_mem_wm_credit = 0;
+#if defined (MEM_THREADS)
+	mem_reporter_start();
+	pthread_cond_signal(&_mem_wm_cv);
+#endif	/* MEM_THREADS */
+	MEM_UNLOCK();
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = mem_sig_handler;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	if (sigaction(sig, &sa, NULL) < 0)
+		return (-1);
+	return (0);
+}
+
+/*
+ * Switch tracking on or off at run time, returns whether it was on.
+ * While off the entry points cost a test and go to the C library;
+ * blocks recorded before are still released through the tracker.
+ */
+int
+mem_enable(on)
+	int	on;
+{
+	int was;
+
+	if (_mem_init == 0)
+		return (-1);
+
+	MEM_LOCK();
+	was = _mem_on & ~MEM_ON_SWITCH;
+	mem_switch(on != 0);
+	MEM_UNLOCK();
+	return (was);
+}
+
+/* Have signal `sig' toggle tracking */
+int
+mem_toggle_signal(sig)
+	int	sig;
+{
+	struct sigaction sa;
+
+	if (_mem_init == 0)
+		return (-1);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = mem_toggle_handler;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	return (sigaction(sig, &sa, NULL));
+}
+
+/*
+ * Write the live memory by site, the `top' sites holding most bytes
+ * first (all if `top' is 0), to `fd' with a single writev().  Meant
+ * for very large heaps: the record pool is walked in address order on
+ * several threads into partial tables set aside beforehand, the top
+ * sites are picked with a partial sort, and nothing is allocated.
+ * Other threads wait for the lock only while the records are walked.
+ * The walking threads are started by the first report; only then
+ * are their stacks allocated.  Lines that do not fit in
+ * MEM_REPORT_BUF are left out.  Returns the number of sites written.
+ */
+int
+mem_report(fd, top)
+	int	fd;
+	int	top;
+{
+	struct mem_rpt *rp, *all;
+	struct mem_site *ms;
+	struct iovec iov[2];
+	u_int64_t t0, now;
+	u_long count, bytes, rcount, rbytes;
+	double tick;
+	char age[32];
+	size_t len, off;
+	int i, n, nthr, nsite, nout;
+
+	if (_mem_init == 0 || fd < 0)
+		return (-1);
+
+	MEM_RPT_LOCK();
+	MEM_LOCK();
+	t0 = mem_nsec();
+	_mem_rpt_next = 0;
+	nthr = 1;
+#if defined (MEM_THREADS)
+	mem_rpt_start();
+	pthread_mutex_lock(&_mem_rpt_lock);
+	nthr += _mem_rpt_nthr;
+	_mem_rpt_claim = 1;
+	_mem_rpt_want = _mem_rpt_busy = _mem_rpt_nthr;
+	pthread_cond_broadcast(&_mem_rpt_cv);
+	pthread_mutex_unlock(&_mem_rpt_lock);
+	mem_rpt_worker(&_mem_rpt[0]);
+	pthread_mutex_lock(&_mem_rpt_lock);
+	while (_mem_rpt_busy != 0)
+		pthread_cond_wait(&_mem_rpt_done, &_mem_rpt_lock);
+	pthread_mutex_unlock(&_mem_rpt_lock);
+#else
+	mem_rpt_worker(&_mem_rpt[0]);
+#endif	/* MEM_THREADS */
+	/* The partial tables hold all we need, let the others go on */
+	MEM_UNLOCK();
+
+	/* Merge into the first table */
+	all = &_mem_rpt[0];
+	for (n = 1; n < nthr; n++) {
+		rp = &_mem_rpt[n];
+		all->rp_nold += rp->rp_nold;
+		for (i = 0; i < MEM_SITES; i++) {
+			if (rp->rp_count[i] == 0)
+				continue;
+			if (all->rp_count[i] == 0 ||
+			    rp->rp_oldest[i] < all->rp_oldest[i])
+				all->rp_oldest[i] = rp->rp_oldest[i];
+			all->rp_count[i] += rp->rp_count[i];
+			all->rp_bytes[i] += rp->rp_bytes[i];
+		}
+	}
+	count = bytes = 0;
+	for (i = nsite = 0; i < MEM_SITES; i++) {
+		if (all->rp_count[i] == 0)
+			continue;
+		count += all->rp_count[i];
+		bytes += all->rp_bytes[i];
+		_mem_rpt_id[nsite++] = i;
+	}
+	if (top <= 0 || top > nsite)
+		top = nsite;
+	if (top < nsite)
+		mem_rpt_select(_mem_rpt_id, 0, nsite, top, all->rp_bytes);
+	mem_rpt_sort(_mem_rpt_id, 0, top, all->rp_bytes);
+
+	tick = mem_tick_ns();
+	now = mem_clock();
+	off = 0;
+	rcount = rbytes = 0;
+	for (nout = 0; nout < top; nout++) {
+		i = _mem_rpt_id[nout];
+		ms = &_mem_site[i];
+		mem_fmt_ns(age, sizeof(age),
+		    (double)(now - all->rp_oldest[i]) * tick);
+		len = snprintf(_mem_rpt_buf + off, sizeof(_mem_rpt_buf) - off,
+		    "%12lu %10lu %8s  %s %s:%d\n", all->rp_bytes[i],
+		    all->rp_count[i], age, MEM_TYPE_NAME(ms->ms_type),
+		    ms->ms_file, ms->ms_line);
+		if (len >= sizeof(_mem_rpt_buf) - off - 160)
+			break;
+		off += len;
+		rcount += all->rp_count[i];
+		rbytes += all->rp_bytes[i];
+	}
+	if (nout < nsite)
+		off += snprintf(_mem_rpt_buf + off, sizeof(_mem_rpt_buf) - off,
+		    "%12lu %10lu %8s  (%d more sites)\n", bytes - rbytes,
+		    count - rcount, "", nsite - nout);
+	if (all->rp_nold != 0)
+		off += snprintf(_mem_rpt_buf + off, sizeof(_mem_rpt_buf) - off,
+		    "%lu blocks recorded before tracking was last switched "
+		    "on are not listed\n", all->rp_nold);
+	len = snprintf(_mem_rpt_hdr, sizeof(_mem_rpt_hdr),
+	    "** Memory watchdog report: %lu bytes in %lu blocks from %d "
+	    "sites (%d threads, %.1f ms)\n%12s %10s %8s  %s\n", bytes,
+	    count, nsite, nthr, (mem_nsec() - t0) / 1e6, "bytes", "blocks",
+	    "oldest", "site");
+
+	iov[0].iov_base = _mem_rpt_hdr;
+	iov[0].iov_len = len;
+	iov[1].iov_base = _mem_rpt_buf;
+	iov[1].iov_len = off;
+	if (mem_writev(fd, iov, 2) < 0)
+		nout = -1;
+	MEM_RPT_UNLOCK();
+	return (nout);
+}
+
+/*
+ * Start a new generation and return its id, 1 for the first.  Blocks
+ * recorded from now on belong to it until the next mark; each
+ * generation keeps live blocks and bytes by site, so what is still
+ * live of them is known without walking the records.
+ */
+u_long
+mem_mark()
 {
+	struct mem_gen *g, *old;
+	u_long id;
 	int i;
+
+	if (_mem_init == 0)
+		return (0);
+
+	MEM_LOCK();
+	id = ++_mem_gen_id;
+	g = &_mem_gen[id % MEM_GENS];
+	if (id > MEM_GENS) {
+		/* Fold the generation this slot held into the next one */
+		old = &_mem_gen[(id + 1) % MEM_GENS];
+		for (i = 0; i < MEM_SITES; i++) {
+			old->gn_count[i] += g->gn_count[i];
+			old->gn_bytes[i] += g->gn_bytes[i];
+		}
+		old->gn_seq = g->gn_seq;
+	}
+	memset(g, 0, sizeof(*g));
+	g->gn_id = id;
+	g->gn_seq = _mem_seq;
+	MEM_UNLOCK();
+	return (id);
+}
+
+/*
+ * Like mem_report(), for the blocks recorded since mark `gen' and
+ * still live: adds up the counters of the generations from `gen' on,
+ * without looking at the records.  With `gen' older than the kept
+ * generations the oldest kept is reported from, with 0 all live
+ * blocks.  Returns the number of sites written.
+ */
+int
+mem_report_since(gen, fd, top)
+	u_long	gen;
+	int	fd;
+	int	top;
+{
+	struct mem_rpt *all;
+	struct mem_site *ms;
+	struct mem_gen *g;
+	struct iovec iov[2];
+	u_long count, bytes, rcount, rbytes, id, from;
+	size_t len, off;
+	int i, nsite, nout;
+
+	if (_mem_init == 0 || fd < 0)
+		return (-1);
+
+	MEM_RPT_LOCK();
+	MEM_LOCK();
+	all = &_mem_rpt[0];
+	memset(all->rp_count, 0, sizeof(all->rp_count));
+	memset(all->rp_bytes, 0, sizeof(all->rp_bytes));
+	from = gen;
+	if (gen == 0)
+		for (i = 0; i < MEM_SITES && i < _mem_nsites; i++) {
+			ms = &_mem_site[i];
+			all->rp_count[i] = ms->ms_nalloc - ms->ms_nfree;
+			all->rp_bytes[i] = ms->ms_bytes - ms->ms_fbytes;
+		}
+	else {
+		if (from + MEM_GENS <= _mem_gen_id)
+			from = _mem_gen_id - MEM_GENS + 1;
+		for (id = from; id <= _mem_gen_id; id++) {
+			g = &_mem_gen[id % MEM_GENS];
+			for (i = 0; i < MEM_SITES && i < _mem_nsites; i++) {
+				all->rp_count[i] += g->gn_count[i];
+				all->rp_bytes[i] += g->gn_bytes[i];
+			}
+		}
+	}
+	count = bytes = 0;
+	for (i = nsite = 0; i < MEM_SITES && i < _mem_nsites; i++) {
+		if (all->rp_count[i] == 0)
+			continue;
+		count += all->rp_count[i];
+		bytes += all->rp_bytes[i];
+		_mem_rpt_id[nsite++] = i;
+	}
+	if (top <= 0 || top > nsite)
+		top = nsite;
+	if (top < nsite)
+		mem_rpt_select(_mem_rpt_id, 0, nsite, top, all->rp_bytes);
+	mem_rpt_sort(_mem_rpt_id, 0, top, all->rp_bytes);
+
+	off = 0;
+	rcount = rbytes = 0;
+	for (nout = 0; nout < top; nout++) {
+		i = _mem_rpt_id[nout];
+		ms = &_mem_site[i];
+		len = snprintf(_mem_rpt_buf + off, sizeof(_mem_rpt_buf) - off,
+		    "%12lu %10lu  %s %s:%d\n", all->rp_bytes[i],
+		    all->rp_count[i], MEM_TYPE_NAME(ms->ms_type),
+		    ms->ms_file, ms->ms_line);
+		if (len >= sizeof(_mem_rpt_buf) - off - 160)
+			break;
+		off += len;
+		rcount += all->rp_count[i];
+		rbytes += all->rp_bytes[i];
+	}
+	if (nout < nsite)
+		off += snprintf(_mem_rpt_buf + off, sizeof(_mem_rpt_buf) - off,
+		    "%12lu %10lu  (%d more sites)\n", bytes - rbytes,
+		    count - rcount, nsite - nout);
+	if (from != gen)
+		off += snprintf(_mem_rpt_buf + off, sizeof(_mem_rpt_buf) - off,
+		    "mark %lu is no longer kept, reported from mark %lu\n",
+		    gen, from);
+	len = snprintf(_mem_rpt_hdr, sizeof(_mem_rpt_hdr),
+	    "** Memory watchdog report since mark %lu: %lu bytes in %lu "
+	    "blocks from %d sites\n%12s %10s  %s\n", from, bytes, count,
+	    nsite, "bytes", "blocks", "site");
+
+	iov[0].iov_base = _mem_rpt_hdr;
+	iov[0].iov_len = len;
+	iov[1].iov_base = _mem_rpt_buf;
+	iov[1].iov_len = off;
+	if (mem_writev(fd, iov, 2) < 0)
+		nout = -1;
+	MEM_UNLOCK();
+	MEM_RPT_UNLOCK();
+	return (nout);
+}
+
+/*
+ * Write an allocation profile in the gzipped protobuf format of pprof
+ * to `fd': for every allocation site the blocks and bytes allocated
+ * since mem_init() and those still live, as sample types
+ * alloc_objects, alloc_space, inuse_objects and inuse_space.  A site
+ * is a one frame "stack" named after its kind, file and line.  The
+ * profile is encoded straight from the site table into the report
+ * buffer and written a stored deflate block at a time, so nothing is
+ * allocated however large the heap.  Returns the number of sites
+ * written, -1 if writing failed.
+ */
+int
+mem_profile(fd)
+	int	fd;
+{
+	static const char *names[] = { "", "alloc_objects", "count",
+	    "alloc_space", "bytes", "inuse_objects", "inuse_space" };
+	static const int types[][2] = { { 1, 2 }, { 3, 4 }, { 5, 2 },
+	    { 6, 4 } };
+	struct mem_pf pf;
+	struct mem_site *ms;
+	u_char gz[10], msg[128], val[64], *data, *p, *q, *v;
+	const char *file;
+	u_int64_t id, now;
+	size_t len;
+	int i, nout;
+
+	if (_mem_init == 0 || fd < 0)
+		return (-1);
+
+	MEM_RPT_LOCK();
+	MEM_LOCK();
+	memset(&pf, 0, sizeof(pf));
+	pf.pf_fd = fd;
+	now = (u_int64_t)time(NULL);
+	memset(gz, 0, sizeof(gz));
+	gz[0] = 0x1f;
+	gz[1] = 0x8b;
+	gz[2] = 8;		/* Deflate */
+	for (i = 0; i < 4; i++)
+		gz[4 + i] = (u_char)(now >> (8 * i));
+	gz[9] = 3;		/* Unix */
+	if (mem_write(fd, gz, sizeof(gz)) < 0)
+		pf.pf_err = 1;
+
+	/* Header fields, string_table[0] has to be "" */
+	data = p = (u_char *)_mem_rpt_buf + 5;
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+		p = mem_pb_bytes(p, 6, names[i], strlen(names[i]));
+	pf.pf_nstr = i;
+	for (i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+		q = mem_pb_uint(msg, 1, types[i][0]);
+		q = mem_pb_uint(q, 2, types[i][1]);
+		p = mem_pb_bytes(p, 1, msg, q - msg);
+	}
+	p = mem_pb_bytes(p, 11, msg, q - msg);	/* inuse_space/bytes */
+	p = mem_pb_uint(p, 12, 1);
+	p = mem_pb_uint(p, 9, now * 1000000000);
+	p = mem_pb_uint(p, 10, mem_nsec() - _mem_nsec0);
+	p = mem_pb_uint(p, 14, 6);
+	pf.pf_off = p - data;
+
+	/* A string pair, function, location and sample per site */
+	nout = 0;
+	for (i = 0; i < MEM_SITES && i < _mem_nsites; i++) {
+		ms = &_mem_site[i];
+		if (ms->ms_nalloc == 0)
+			continue;
+		file = ms->ms_file != NULL ? ms->ms_file : "?";
+		len = strlen(file);
+		if (2 * len + 512 > MEM_PF_BLOCK)
+			continue;
+		if (pf.pf_off + 2 * len + 512 > MEM_PF_BLOCK)
+			mem_pf_flush(&pf, 0);
+		p = data + pf.pf_off;
+		id = i + 1;
+
+		len = snprintf(NULL, 0, "%s %s:%d",
+		    MEM_TYPE_NAME(ms->ms_type), file, ms->ms_line);
+		p = mem_pb_varint(p, 6 << 3 | 2);
+		p = mem_pb_varint(p, len);
+		snprintf((char *)p, len + 1, "%s %s:%d",
+		    MEM_TYPE_NAME(ms->ms_type), file, ms->ms_line);
+		p += len;
+		p = mem_pb_bytes(p, 6, file, strlen(file));
+
+		q = mem_pb_uint(msg, 1, id);
+		q = mem_pb_uint(q, 2, pf.pf_nstr);
+		q = mem_pb_uint(q, 3, pf.pf_nstr);
+		q = mem_pb_uint(q, 4, pf.pf_nstr + 1);
+		q = mem_pb_uint(q, 5, ms->ms_line);
+		p = mem_pb_bytes(p, 5, msg, q - msg);
+		pf.pf_nstr += 2;
+
+		v = mem_pb_uint(val, 1, id);
+		v = mem_pb_uint(v, 2, ms->ms_line);
+		q = mem_pb_uint(msg, 1, id);
+		q = mem_pb_bytes(q, 4, val, v - val);
+		p = mem_pb_bytes(p, 4, msg, q - msg);
+
+		v = mem_pb_varint(val, ms->ms_nalloc);
+		v = mem_pb_varint(v, ms->ms_bytes);
+		v = mem_pb_varint(v, ms->ms_nalloc - ms->ms_nfree);
+		v = mem_pb_varint(v, ms->ms_bytes - ms->ms_fbytes);
+		q = msg;
+		*q++ = 1 << 3 | 2;	/* Packed location_id */
+		q = mem_pb_varint(q + 1, id);
+		msg[1] = q - msg - 2;
+		q = mem_pb_bytes(q, 2, val, v - val);
+		p = mem_pb_bytes(p, 2, msg, q - msg);
+
+		pf.pf_off = p - data;
+		++nout;
+	}
+	mem_pf_flush(&pf, 1);
+	for (i = 0; i < 4; i++) {
+		gz[i] = (u_char)(pf.pf_crc >> (8 * i));
+		gz[4 + i] = (u_char)(pf.pf_isize >> (8 * i));
+	}
+	if (pf.pf_err == 0 && mem_write(fd, gz, 8) < 0)
+		pf.pf_err = 1;
+	MEM_UNLOCK();
+	MEM_RPT_UNLOCK();
+	return (pf.pf_err ? -1 : nout);
+}
+
+/*
+ * Id of the accounting tag `name', made the first time it is asked
+ * for; `name' is kept, not copied.  Returns 0, untagged, when all
+ * MEM_TAGS are taken.
+ */
+int
+mem_tag(name)
+	const	char *name;
+{
+	int t;
+
+	if (_mem_init == 0 || name == NULL)
+		return (0);
+
+	MEM_LOCK();
+	for (t = 1; t < _mem_ntags; t++)
+		if (strcmp(_mem_tag[t].mt_name, name) == 0)
+			break;
+	if (t == _mem_ntags) {
+		if (t == MEM_TAGS)
+			t = 0;
+		else
+			_mem_tag[_mem_ntags++].mt_name = name;
+	}
+	MEM_UNLOCK();
+	return (t);
+}
+
+/*
+ * Charge the blocks this thread allocates from now on to `tag',
+ * returns the tag they were charged to before.
+ */
+int
+mem_tag_set(tag)
+	int	tag;
+{
+	int old;
+
+	old = _mem_tag_cur;
+	_mem_tag_cur = tag > 0 && tag < _mem_ntags ? tag : 0;
+	return (old);
+}
+
+/* Cleanup handler of MEM_TAG_SCOPE() */
+void
+mem_tag_restore(tag)
+	int	*tag;
+{
+
+	(void)mem_tag_set(*tag);
+	return;
+}
+
+/*
+ * Soft budget of `bytes' live bytes for `tag', 0 removes it.  When the
+ * tag goes over budget `cb' is called with the tag, its live bytes and
+ * `arg': with MEM_THREADS on the reporter thread, otherwise from the
+ * call that crossed it, once that has let go of the lock.  It is called
+ * again only after the tag went back under budget.  Totals are merged
+ * lazily, so the call may come up to MEM_TAG_FLUSH bytes per thread
+ * late.
+ */
+int
+mem_tag_budget(tag, bytes, cb, arg)
+	int	tag;
+	size_t	bytes;
+	void	(*cb)(int,long,void *);
+	void	*arg;
+{
+	struct mem_tag *mt;
+
+	if (_mem_init == 0 || tag < 0 || tag >= _mem_ntags)
+		return (-1);
+
+	MEM_LOCK();
+	mt = &_mem_tag[tag];
+	mt->mt_budget	= bytes;
+	mt->mt_cb	= cb;
+	mt->mt_arg	= arg;
+	mt->mt_over	= 0;
+#if defined (MEM_THREADS)
+	if (cb != NULL)
+		mem_reporter_start();
+#endif	/* MEM_THREADS */
+	mem_tag_merge(tag, NULL);
+	MEM_UNLOCK();
+	return (0);
+}
+
+/*
+ * Totals of `tag', without walking the records, with what the threads
+ * did not merge yet folded in.
+ */
+int
+mem_tag_info(tag, ti)
+	int	tag;
+	struct	mem_tag_info *ti;
+{
+	struct mem_tag *mt;
+
+	if (_mem_init == 0 || tag < 0 || tag >= _mem_ntags)
+		return (-1);
+
+	MEM_LOCK();
+	mem_tag_merge(tag, NULL);
+	mt = &_mem_tag[tag];
+	ti->ti_name	= mt->mt_name;
+	ti->ti_bytes	= mt->mt_bytes;
+	ti->ti_count	= mt->mt_count;
+	ti->ti_peak	= mt->mt_peak;
+	ti->ti_budget	= mt->mt_budget;
+	ti->ti_nover	= mt->mt_nover;
+	MEM_UNLOCK();
+	return (0);
+}
+
+void
+mem_stats()
+{
+	int i, old, hdr;
 	struct mem_chunk *m;
 	struct chunk_bucket_t *bkt;
 
 	if (_mem_init == 0)
 		return;
 
-	MLOG(("** Memory watchdog statistics:\n"));
-	MLOG((">> memory pool:\n"));
+	MEM_LOCK();
+	mem_log_flush();
+	MREPORT(("** Memory watchdog statistics:\n"));
+	MREPORT((">> memory pool:\n"));
 	mpool_stats();
+	MREPORT((">> tracker cost:\n"));
+	mem_self_report();
+#if defined (MEM_QUARANTINE)
+	MREPORT((">> quarantine: %d of %d blocks, %lu of %lu bytes\n",
+	    _mem_qlen, _mem_qmaxfrees, (u_long)_mem_qbytes,
+	    (u_long)_mem_qmaxbytes));
+#endif	/* MEM_QUARANTINE */
 
+	old = 0;
 	for (i = 0; i < HASH_SIZE; i++) {
 		bkt = &_mem_hash[i];
 		if (TAILQ_FIRST(bkt) == NULL)
 			continue;
-		MLOG(("\tbucket [%d]\n", i));
+		hdr = 0;
 		TAILQ_FOREACH(m, bkt, mc_link) {
-			MLOG(("\t\t%s (%d bytes) %s %d [0x%lx]\n",
-			    m->mc_type == MEM_TYPE_ALLOC ? "alloc" :
-			    m->mc_type == MEM_TYPE_REALLOC ? "realloc" : 
-			    "UNKNOWN", m->mc_size, m->mc_file, 
-			    m->mc_line, (u_long)m->mc_p));
+			if (m->mc_seq < _mem_epoch_seq) {
+				++old;
+				continue;
+			}
+			if (hdr++ == 0)
+				MREPORT(("\tbucket [%d]\n", i));
+			MREPORT(("\t\t%s (%d bytes) %s %d [0x%lx]\n",
+			    MEM_TYPE_NAME(MEM_SITE(m)->ms_type), m->mc_size,
+			    MEM_SITE(m)->ms_file, MEM_SITE(m)->ms_line,
+			    (u_long)m->mc_p));
 		}
 	}
-	MLOG(("DONE\n"));
+	mem_epoch_report(old);
+	mem_arena_report();
+	mem_tag_report();
+	MREPORT(("DONE\n"));
+	MEM_UNLOCK();
 	return;
 }
+
+#if defined (MEM_BENCH)
+
+/*
+ * Cost of the entry points with tracking switched off, against the C
+ * library alone:
+ *
+ *	cc -O2 -DMEM_BENCH -I. -Iwin32 mem_watch.c mem_log.c m_pool.c
+ *
+ * RESULTS: (x86_64, ns per malloc+free pair, no MEM_THREADS)
+ *	malloc/free                       13.1
+ *	_mem_malloc/_mem_free, off        12.9
+ *	mem_malloc/mem_free, off          13.2
+ *	mem_malloc/mem_free, on          143.4
+ */
+
+#include <sys/time.h>
+
+#define BENCH_N		2000000
+#define BENCH_BATCH	64
+
+static double
+bench_now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+int
+main(argc, argv)
+	int	argc;
+	char	**argv;
+{
+	void * volatile p[BENCH_BATCH];
+	double t;
+	int i, j, pass;
+
+	setenv("MEM_WATCH", "0", 1);
+	mem_init();
+	for (pass = 0; pass < 4; pass++) {
+		if (pass == 3)
+			mem_enable(1);
+		t = bench_now();
+		for (i = 0; i < BENCH_N; i += BENCH_BATCH) {
+			for (j = 0; j < BENCH_BATCH; j++)
+				switch (pass) {
+				case 0:
+					p[j] = malloc(j + 1);
+					break;
+				case 1:
+					p[j] = _mem_malloc(j + 1, __FILE__,
+					    __LINE__);
+					break;
+				default:
+					p[j] = mem_malloc(j + 1);
+					break;
+				}
+			for (j = 0; j < BENCH_BATCH; j++)
+				switch (pass) {
+				case 0:
+					free(p[j]);
+					break;
+				case 1:
+					_mem_free(p[j], __FILE__, __LINE__);
+					break;
+				default:
+					mem_free(p[j]);
+					break;
+				}
+		}
+		t = (bench_now() - t) * 1e9 / BENCH_N;
+		printf("%-34s %6.1f\n", pass == 0 ? "malloc/free" :
+		    pass == 1 ? "_mem_malloc/_mem_free, off" :
+		    pass == 2 ? "mem_malloc/mem_free, off" :
+		    "mem_malloc/mem_free, on", t);
+	}
+	return (0);
+}
+
+#endif	/* MEM_BENCH */
@@ -0,0 +1,305 @@
+/* $Id: mem_watch.h,v 1.1 2003/01/12 20:14:02 te Exp $ */
+
+/*
+ * Copyright (c) 2003 Tamer Embaby <tsemba@menanet.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Interface to mem_watch.c, see the description there.
+ */
+
+#if !defined (MEM_WATCH_H)
+# define MEM_WATCH_H
+
+#include <stddef.h>
+
+#if defined (__cplusplus)
+extern "C" {
+#endif
+
+void	mem_init(void);
+void	mem_deinit(void);
+void	mem_stats(void);
+void	mpool_stats(void);
+void	mem_alloc_notify(void *,size_t,const char *,int);
+void	mem_realloc_notify(void *,size_t,const char *,int);
+void	mem_free_notify(void *,const char *,int);
+
+/*
+ * Tracked allocator wrappers around malloc()/realloc()/free().  With
+ * MEM_REDZONE defined every block is surrounded by canary bytes that
+ * are verified on free and by mem_check(); blocks matching a
+ * mem_guard_size()/mem_guard_site() rule get their own pages followed
+ * by an inaccessible guard page instead.
+ */
+void	*_mem_malloc(size_t,const char *,int);
+void	*_mem_calloc(size_t,size_t,const char *,int);
+void	*_mem_realloc(void *,size_t,const char *,int);
+void	_mem_free(void *,const char *,int);
+int	mem_check(void);
+int	mem_guard_size(size_t,size_t);
+int	mem_guard_site(const char *,int);
+
+/*
+ * With MEM_QUARANTINE freed blocks are poisoned and held back for a
+ * while; writes to them are reported when they are finally released.
+ */
+int	mem_quarantine(size_t,int);
+
+/*
+ * Report only blocks that are not referenced from the stacks, data
+ * segments, registered roots or other reachable blocks.
+ */
+int	mem_leaks(void);
+int	mem_scan_root(void *,size_t);
+void	mem_scan_unroot(void *);
+
+/*
+ * Per callsite allocation counts, bytes, sizes and lifetime
+ * distribution of the blocks freed so far.  mem_site_stats() prints
+ * the busiest sites, mem_site_next() and mem_site_find() return the
+ * counters, mem_report() writes the live memory by site to a file
+ * descriptor and mem_profile() all of them as a gzipped pprof profile.
+ * mem_report_since() writes only what is live of the blocks recorded
+ * after a mem_mark(), e.g. around a test case.  si_sizes[0] counts 0
+ * byte blocks, si_sizes[c] those of 2^(c-1) to 2^c - 1 bytes.
+ */
+#define MEM_SIZE_CLASSES	32
+
+struct mem_site_info {
+	const	char *si_file;
+	int	si_line;
+	unsigned long si_nalloc;	/* Blocks allocated */
+	unsigned long si_bytes;		/* and their total size */
+	unsigned long si_nfree;		/* Blocks freed */
+	unsigned long si_live;		/* Bytes still allocated */
+	double	si_rate;		/* Allocations per second */
+	unsigned long si_sizes[MEM_SIZE_CLASSES];
+};
+
+void	mem_site_stats(void);
+int	mem_report(int,int);
+int	mem_profile(int);
+unsigned long mem_mark(void);
+int	mem_report_since(unsigned long,int,int);
+int	mem_site_next(int,struct mem_site_info *);
+int	mem_site_find(const char *,int,struct mem_site_info *);
+
+/*
+ * Heap growth triggers: a snapshot of the sites holding most memory
+ * is written when a watermark is crossed, see mem_watermark().
+ */
+int	mem_watermark(size_t,unsigned long,size_t,int);
+int	mem_watermark_file(const char *);
+void	mem_snapshot(void);
+int	mem_signal(int,int,int);
+
+/*
+ * Run time switch, also set by the environment: MEM_WATCH=0 starts
+ * with tracking off, MEM_WATCH_SIGNAL=<signal number> toggles it.
+ */
+int	mem_enable(int);
+int	mem_toggle_signal(int);
+
+/*
+ * Accounting tags: each block is charged to the tag current in the
+ * allocating thread (mem_tag_set(), or MEM_TAG_SCOPE() for the rest
+ * of a block with GCC), 0 when none was set.  mem_tag_info() gives a
+ * tag's live bytes and blocks without walking the records, and
+ * mem_tag_budget() calls back when they go over a soft budget.
+ */
+struct mem_tag_info {
+	const	char *ti_name;
+	long	ti_bytes;	/* Live bytes */
+	long	ti_count;	/* and blocks */
+	long	ti_peak;	/* Most live bytes seen */
+	size_t	ti_budget;
+	unsigned long ti_nover;	/* Times the budget was crossed */
+};
+
+int	mem_tag(const char *);
+int	mem_tag_set(int);
+void	mem_tag_restore(int *);
+int	mem_tag_budget(int,size_t,void (*)(int,long,void *),void *);
+int	mem_tag_info(int,struct mem_tag_info *);
+
+#if defined (__GNUC__)
+# define MEM_TAG_SCOPE(tag)						\
+	int __mem_tag_prev __attribute__((__cleanup__(mem_tag_restore))) = \
+	    mem_tag_set(tag)
+#endif	/* __GNUC__ */
+
+/*
+ * What the tracker costs: time spent in the allocation, reallocation
+ * and free paths by a sample of the calls (in CPU cycles where
+ * sx_cycles says so, nanoseconds otherwise) with a histogram by power
+ * of two as for si_sizes, the chain steps taken by record lookups, how
+ * full the record hash is, how far the pool bitmap was searched for a
+ * free record, and the memory of the tracker's own tables.
+ */
+#define MEM_SELF_ALLOC		0
+#define MEM_SELF_REALLOC	1
+#define MEM_SELF_FREE		2
+#define MEM_SELF_PATHS		3
+
+struct mem_self_info {
+	int	sx_cycles;			/* Times are in cycles */
+	unsigned long sx_timed[MEM_SELF_PATHS];	/* Calls timed */
+	unsigned long sx_time[MEM_SELF_PATHS];	/* Their total */
+	unsigned long sx_max[MEM_SELF_PATHS];
+	unsigned long sx_hist[MEM_SELF_PATHS][MEM_SIZE_CLASSES];
+	unsigned long sx_lookups;	/* Records looked up by address */
+	unsigned long sx_probes;	/* Chain steps they took */
+	unsigned long sx_maxprobe;
+	unsigned long sx_probe_hist[MEM_SIZE_CLASSES];
+	unsigned long sx_buckets;	/* Hash buckets */
+	unsigned long sx_bused;		/* not empty */
+	unsigned long sx_records;	/* Records in the hash */
+	unsigned long sx_maxchain;
+	double	sx_load;		/* Records per bucket */
+	unsigned long sx_gets;		/* Records taken from the pool */
+	unsigned long sx_scan;		/* Bitmap bytes searched */
+	unsigned long sx_maxscan;
+	unsigned long sx_mapped;	/* Bytes of tracker tables */
+	unsigned long sx_resident;	/* of which in core, 0 if unknown */
+};
+
+int	mem_self(struct mem_self_info *);
+
+/*
+ * Publish the counters in shared memory for mwtop, see mem_shm.h.
+ */
+int	mem_shm_export(int);
+
+/*
+ * Owner of an address, mi_age counts the records made since the
+ * block was.
+ */
+struct mem_info {
+	void	*mi_p;
+	size_t	mi_size;
+	const	char *mi_file;
+	int	mi_line;
+	unsigned long mi_age;
+};
+
+int	mem_lookup(const void *,struct mem_info *);
+
+/*
+ * Arenas: blocks freed all at once are logged by mem_arena_alloc()
+ * and dropped together by mem_arena_end(), only arenas never ended
+ * are reported.
+ */
+struct	mem_arena;
+
+struct	mem_arena *_mem_arena_begin(const char *,const char *,int);
+void	mem_arena_alloc(struct mem_arena *,void *,size_t);
+void	mem_arena_end(struct mem_arena *);
+
+#define mem_arena_begin(name)	_mem_arena_begin(name, __FILE__, __LINE__)
+
+/*
+ * Callsite descriptors.  The mem_*() macros below give every call a
+ * static descriptor, placed in the "mem_sites" section where the
+ * toolchain supports it, and pass its address instead of __FILE__ and
+ * __LINE__.  mem_init() assigns site ids to all of them up front, so
+ * a call indexes its counters directly instead of looking the site
+ * up.  Descriptors the section misses (other toolchains, C++, modules
+ * loaded later) get their ids on first use.  The file/line entry
+ * points still work, at the cost of the lookup.
+ */
+#define MEM_TYPE_ALLOC		1	/* Site types */
+#define MEM_TYPE_REALLOC	2
+#define MEM_TYPE_FREE		3
+
+struct mem_sitedesc {
+	const	char *sd_file;
+	int	sd_line;
+	int	sd_type;		/* MEM_TYPE_* of the call */
+	unsigned int sd_id[MEM_TYPE_FREE];	/* Ids by type, 0 unset */
+};
+
+void	*_mem_malloc_at(size_t,struct mem_sitedesc *);
+void	*_mem_calloc_at(size_t,size_t,struct mem_sitedesc *);
+void	*_mem_realloc_at(void *,size_t,struct mem_sitedesc *);
+void	_mem_free_at(void *,struct mem_sitedesc *);
+void	_mem_free_sized_at(void *,size_t,struct mem_sitedesc *);
+void	*_mem_memalign_at(size_t,size_t,struct mem_sitedesc *);
+void	mem_alloc_notify_at(void *,size_t,struct mem_sitedesc *);
+void	mem_realloc_notify_at(void *,size_t,struct mem_sitedesc *);
+void	mem_free_notify_at(void *,struct mem_sitedesc *);
+
+/*
+ * Not in C++: descriptors of inline functions and templates are COMDAT
+ * and cannot share a section with the others.
+ */
+#if defined (__ELF__) && !defined (__cplusplus)
+# define MEM_SITE_SECTION						\
+	__attribute__((__section__("mem_sites"), __used__))
+#else
+# define MEM_SITE_SECTION
+#endif	/* __ELF__ && !__cplusplus */
+
+#if defined (__GNUC__) && !defined (MEM_NO_SITEDESC)
+/* Evaluate `call' with __msd set to this line's descriptor */
+# define MEM_AT(type, call)	__extension__ ({			\
+	static struct mem_sitedesc __msd MEM_SITE_SECTION =		\
+	    { __FILE__, __LINE__, type, { 0, 0, 0 } };			\
+	call;								\
+})
+
+# define mem_malloc(siz)						\
+	MEM_AT(MEM_TYPE_ALLOC, _mem_malloc_at(siz, &__msd))
+# define mem_calloc(n, siz)						\
+	MEM_AT(MEM_TYPE_ALLOC, _mem_calloc_at(n, siz, &__msd))
+# define mem_realloc(p, siz)						\
+	MEM_AT(MEM_TYPE_REALLOC, _mem_realloc_at(p, siz, &__msd))
+# define mem_free(p)							\
+	MEM_AT(MEM_TYPE_FREE, _mem_free_at(p, &__msd))
+# define mem_alloc_notify_here(p, siz)					\
+	MEM_AT(MEM_TYPE_ALLOC, mem_alloc_notify_at(p, siz, &__msd))
+# define mem_realloc_notify_here(p, siz)				\
+	MEM_AT(MEM_TYPE_REALLOC, mem_realloc_notify_at(p, siz, &__msd))
+# define mem_free_notify_here(p)					\
+	MEM_AT(MEM_TYPE_FREE, mem_free_notify_at(p, &__msd))
+#else
+# define mem_malloc(siz)	_mem_malloc(siz, __FILE__, __LINE__)
+# define mem_calloc(n, siz)	_mem_calloc(n, siz, __FILE__, __LINE__)
+# define mem_realloc(p, siz)	_mem_realloc(p, siz, __FILE__, __LINE__)
+# define mem_free(p)		_mem_free(p, __FILE__, __LINE__)
+# define mem_alloc_notify_here(p, siz)					\
+	mem_alloc_notify(p, siz, __FILE__, __LINE__)
+# define mem_realloc_notify_here(p, siz)				\
+	mem_realloc_notify(p, siz, __FILE__, __LINE__)
+# define mem_free_notify_here(p)					\
+	mem_free_notify(p, __FILE__, __LINE__)
+#endif	/* __GNUC__ && !MEM_NO_SITEDESC */
+
+#if defined (__cplusplus)
+}
+#endif
+
+#endif	/* MEM_WATCH_H */
@@ -0,0 +1,165 @@
+/* $Id: mem_watch.hpp,v 1.1 2003/01/20 19:02:11 te Exp $ */
+
+/*
+ * Copyright (c) 2003 Tamer Embaby <tsemba@menanet.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * C++ interface to mem_watch.c.  mem_allocator<T> is a standard
+ * allocator whose blocks are tracked, all of them accounted to one
+ * site named after the allocated type, which for node based
+ * containers names the container too:
+ *
+ *	std::map<int, conn *, std::less<int>,
+ *	    mem_allocator<std::pair<const int, conn *> > > conns;
+ *
+ * An optional `Tag' type tells apart containers of the same type.
+ * Global operator new and delete are tracked by linking mem_new.o.
+ * mem_tag_scope charges allocations to an accounting tag.
+ */
+
+#if !defined (MEM_WATCH_HPP)
+# define MEM_WATCH_HPP
+
+#include <cstddef>
+#include <new>
+
+#include <mem_watch.h>
+
+template <class T, class Tag = void>
+class mem_allocator {
+public:
+	typedef T		value_type;
+	typedef T		*pointer;
+	typedef const T		*const_pointer;
+	typedef T		&reference;
+	typedef const T		&const_reference;
+	typedef std::size_t	size_type;
+	typedef std::ptrdiff_t	difference_type;
+
+	template <class U>
+	struct rebind {
+		typedef mem_allocator<U, Tag> other;
+	};
+
+	mem_allocator() throw() {}
+	template <class U>
+	mem_allocator(const mem_allocator<U, Tag> &) throw() {}
+
+	T *
+	allocate(std::size_t n, const void * = 0)
+	{
+		void *p;
+
+		if (n > max_size() ||
+		    (p = _mem_malloc_at(n * sizeof(T), site())) == NULL)
+			throw std::bad_alloc();
+		return (static_cast<T *>(p));
+	}
+
+	void
+	deallocate(T *p, std::size_t n)
+	{
+
+		_mem_free_sized_at(p, n * sizeof(T), site());
+	}
+
+	std::size_t
+	max_size() const throw()
+	{
+
+		return ((std::size_t)-1 / sizeof(T));
+	}
+
+#if __cplusplus < 201103L
+	/* Later libraries get these from std::allocator_traits */
+	void
+	construct(T *p, const T &v)
+	{
+
+		new ((void *)p) T(v);
+	}
+
+	void
+	destroy(T *p)
+	{
+
+		p->~T();
+	}
+#endif	/* __cplusplus */
+
+	/* The site of this allocator, named by the compiler */
+	static struct mem_sitedesc *
+	site()
+	{
+#if defined (__GNUC__)
+		static struct mem_sitedesc sd = {
+		    __PRETTY_FUNCTION__, 0, MEM_TYPE_ALLOC, { 0, 0, 0 }
+		};
+#else
+		static struct mem_sitedesc sd = {
+		    __FUNCSIG__, 0, MEM_TYPE_ALLOC, { 0, 0, 0 }
+		};
+#endif	/* __GNUC__ */
+
+		return (&sd);
+	}
+};
+
+template <class T, class U, class Tag>
+inline bool
+operator==(const mem_allocator<T, Tag> &, const mem_allocator<U, Tag> &)
+{
+
+	return (true);
+}
+
+template <class T, class U, class Tag>
+inline bool
+operator!=(const mem_allocator<T, Tag> &, const mem_allocator<U, Tag> &)
+{
+
+	return (false);
+}
+
+/*
+ * Charges what the thread allocates to `tag' while in scope:
+ *
+ *	mem_tag_scope ts(cache_tag);
+ */
+class mem_tag_scope {
+public:
+	explicit mem_tag_scope(int tag) : prev_(mem_tag_set(tag)) {}
+	~mem_tag_scope() { (void)mem_tag_set(prev_); }
+
+private:
+	int	prev_;
+
+	mem_tag_scope(const mem_tag_scope &);
+	mem_tag_scope &operator=(const mem_tag_scope &);
+};
+
+#endif	/* MEM_WATCH_HPP */
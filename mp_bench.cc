@@ -0,0 +1,129 @@
+/* $Id: mp_bench.cc,v 1.1 2003/01/27 22:03:40 te Exp $ */
+
+/*
+ * Copyright (c) 2003 Tamer Embaby <tsemba@menanet.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * m_pool.hpp against the m_pool.h macros, same object, same pool size:
+ *
+ *	cc -O2 -c -I. m_pool.c
+ *	c++ -O2 -I. -o mp_bench mp_bench.cc m_pool.o
+ *
+ * RESULTS: (x86_64, ns per get+put pair, 48 byte objects)
+ *	mpool_get/mpool_reclaim             7.2
+ *	mpool_of::get/put                   6.0
+ *	mpool_of::get/put, inline           5.9
+ *	mpool_of::make/destroy              7.5
+ */
+
+#include <sys/time.h>
+#include <stdio.h>
+
+#include <m_pool.hpp>
+
+#define BENCH_N		8000000
+#define BENCH_BATCH	64
+#define BENCH_OBJS	4096
+
+struct obj {
+	long	o_key;
+	char	o_name [40];
+
+	obj(long key = 0) : o_key(key) { o_name[0] = '\0'; }
+};
+
+static double
+bench_now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (tv.tv_sec + tv.tv_usec / 1e6);
+}
+
+static mpool_of<obj, BENCH_OBJS> heap_objs("heap");
+static mpool_of<obj, BENCH_OBJS, true> inline_objs("inline");
+
+int
+main()
+{
+	static const char *names [] = {
+		"mpool_get/mpool_reclaim",
+		"mpool_of::get/put",
+		"mpool_of::get/put, inline",
+		"mpool_of::make/destroy",
+	};
+	obj * volatile p[BENCH_BATCH];
+	struct mpool *mp;
+	double t;
+	void *m;
+	int i, j, pass;
+
+	if (mpool_init(&mp, (char *)"macro", BENCH_OBJS, sizeof(obj)) < 0)
+		return (1);
+	for (pass = 0; pass < 4; pass++) {
+		t = bench_now();
+		for (i = 0; i < BENCH_N; i += BENCH_BATCH) {
+			for (j = 0; j < BENCH_BATCH; j++)
+				switch (pass) {
+				case 0:
+					mpool_get(mp, m);
+					p[j] = (obj *)m;
+					break;
+				case 1:
+					p[j] = (obj *)heap_objs.get();
+					break;
+				case 2:
+					p[j] = (obj *)inline_objs.get();
+					break;
+				default:
+					p[j] = heap_objs.make(j);
+					break;
+				}
+			for (j = 0; j < BENCH_BATCH; j++)
+				switch (pass) {
+				case 0:
+					m = p[j];
+					mpool_reclaim(mp, m);
+					break;
+				case 1:
+					heap_objs.put(p[j]);
+					break;
+				case 2:
+					inline_objs.put(p[j]);
+					break;
+				default:
+					heap_objs.destroy(p[j]);
+					break;
+				}
+		}
+		t = (bench_now() - t) * 1e9 / BENCH_N;
+		printf("%-34s %6.1f\n", names[pass], t);
+	}
+	mpool_free(mp);
+	return (0);
+}
@@ -0,0 +1,218 @@
+/* $Id: mwpm.c,v 1.1 2003/01/26 15:02:37 te Exp $ */
+
+/*
+ * Copyright (c) 2003 Tamer Embaby <tsemba@menanet.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * mwpm: post-mortem report from the file a process running mem_watch
+ * with MEM_WATCH_FILE set left behind (layout in mem_pm.h).  Lists the
+ * blocks that were live when the process stopped by site, the sites
+ * holding most memory first, and with -l every block.  Needs a file
+ * written on the same kind of machine.
+ *
+ *	mwpm [-l] [-n sites] file
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <mem_watch.h>
+#include <mem_pm.h>
+
+struct pm_sum {
+	int	su_id;
+	unsigned long su_count;
+	unsigned long su_bytes;
+};
+
+static	const char *site_name(const struct mem_pm_hdr *,int,int *,int *);
+static	int sum_cmp(const void *,const void *);
+static	void usage(void);
+
+int
+main(argc, argv)
+	int	argc;
+	char	**argv;
+{
+	const struct mem_pm_hdr *ph;
+	const u_char *p, *bmap, *rec;
+	struct pm_sum *sum;
+	struct stat st;
+	time_t started;
+	const char *file, *type[4] = { "?", "alloc", "realloc", "free" };
+	unsigned long count, bytes, nold, seq;
+	unsigned int sid;
+	void *ptr;
+	int ch, fd, list, top, i, b, n, line, t, size;
+
+	list = 0;
+	top = 32;
+	while ((ch = getopt(argc, argv, "ln:")) != -1) {
+		switch (ch) {
+		case 'l':
+			list = 1;
+			break;
+		case 'n':
+			if ((top = atoi(optarg)) <= 0)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1)
+		usage();
+
+	if ((fd = open(argv[optind], O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+		perror(argv[optind]);
+		return (1);
+	}
+	if ((size_t)st.st_size < sizeof(*ph) ||
+	    (p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) ==
+	    MAP_FAILED) {
+		fprintf(stderr, "mwpm: %s: cannot map\n", argv[optind]);
+		return (1);
+	}
+	close(fd);
+	ph = (const struct mem_pm_hdr *)p;
+	if (ph->ph_magic != MEM_PM_MAGIC || ph->ph_version != MEM_PM_VERSION ||
+	    ph->ph_len != (unsigned long)st.st_size ||
+	    ph->ph_base + (size_t)ph->ph_nobjs * ph->ph_rsiz > ph->ph_len) {
+		fprintf(stderr, "mwpm: %s: unknown layout\n", argv[optind]);
+		return (1);
+	}
+	if ((sum = calloc(ph->ph_nsites, sizeof(*sum))) == NULL) {
+		fprintf(stderr, "mwpm: out of memory\n");
+		return (1);
+	}
+
+	started = ph->ph_started;
+	printf("pid %d, started %s", ph->ph_pid, ctime(&started));
+	printf("%s\n", ph->ph_state == MEM_PM_EXITED ? "exited through "
+	    "mem_deinit()" : "did not exit cleanly (or is still running)");
+	if (list)
+		printf("\n%18s %10s %10s  %s\n", "BLOCK", "BYTES", "RECORD",
+		    "SITE");
+	bmap = p + ph->ph_bmap;
+	count = bytes = nold = 0;
+	for (b = 0; b < ph->ph_nobjs; b++) {
+		if ((bmap[b >> 3] & (1 << (b & 7))) == 0)
+			continue;
+		rec = p + ph->ph_base + (size_t)b * ph->ph_rsiz;
+		memcpy(&sid, rec + ph->ph_osid, sizeof(sid));
+		memcpy(&size, rec + ph->ph_osize, sizeof(size));
+		memcpy(&ptr, rec + ph->ph_optr, sizeof(ptr));
+		memcpy(&seq, rec + ph->ph_oseq, sizeof(seq));
+		if (seq < ph->ph_epoch_seq) {
+			++nold;
+			continue;
+		}
+		if (sid >= (unsigned int)ph->ph_nsites)
+			sid = 0;
+		sum[sid].su_id = sid;
+		++sum[sid].su_count;
+		sum[sid].su_bytes += size;
+		++count;
+		bytes += size;
+		if (list) {
+			file = site_name(ph, sid, &line, &t);
+			printf("%18p %10d %10lu  %s %s:%d\n", ptr, size, seq,
+			    type[t], file, line);
+		}
+	}
+
+	qsort(sum, ph->ph_nsites, sizeof(*sum), sum_cmp);
+	printf("\nlive: %lu bytes in %lu blocks\n", bytes, count);
+	if (nold != 0)
+		printf("%lu blocks recorded before tracking was last "
+		    "switched on are not listed\n", nold);
+	printf("\n%12s %10s  %s\n", "BYTES", "BLOCKS", "SITE");
+	for (i = n = 0; i < ph->ph_nsites && sum[i].su_count != 0; i++) {
+		if (n++ == top) {
+			for (count = bytes = 0; i < ph->ph_nsites; i++) {
+				count += sum[i].su_count;
+				bytes += sum[i].su_bytes;
+			}
+			printf("%12lu %10lu  (other sites)\n", bytes, count);
+			break;
+		}
+		file = site_name(ph, sum[i].su_id, &line, &t);
+		printf("%12lu %10lu  %s %s:%d\n", sum[i].su_bytes,
+		    sum[i].su_count, type[t], file, line);
+	}
+	return (0);
+}
+
+/* Name, line and type of site `id' */
+static const char *
+site_name(ph, id, line, type)
+	const	struct mem_pm_hdr *ph;
+	int	id;
+	int	*line;
+	int	*type;
+{
+	const struct mem_pm_site *ps;
+
+	ps = (const struct mem_pm_site *)((const char *)ph +
+	    ph->ph_sites) + id;
+	*line = ps->ps_line;
+	*type = ps->ps_type >= MEM_TYPE_ALLOC && ps->ps_type <= MEM_TYPE_FREE ?
+	    ps->ps_type : 0;
+	if (ps->ps_file == 0 || ps->ps_file >= ph->ph_strsz)
+		return ("(unknown)");
+	return ((const char *)ph + ph->ph_strs + ps->ps_file);
+}
+
+/* Most bytes first */
+static int
+sum_cmp(a, b)
+	const	void *a;
+	const	void *b;
+{
+	const struct pm_sum *x = a, *y = b;
+
+	if (x->su_bytes != y->su_bytes)
+		return (x->su_bytes < y->su_bytes ? 1 : -1);
+	return (x->su_count < y->su_count ? 1 : x->su_count > y->su_count ?
+	    -1 : 0);
+}
+
+static void
+usage()
+{
+
+	fprintf(stderr, "usage: mwpm [-l] [-n sites] file\n");
+	exit(1);
+}
@@ -0,0 +1,170 @@
+/* $Id: mwtop.c,v 1.1 2003/01/19 18:40:11 te Exp $ */
+
+/*
+ * Copyright (c) 2003 Tamer Embaby <tsemba@menanet.net>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL
+ * THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * mwtop: show the counters a process running mem_watch publishes with
+ * mem_shm_export(), refreshed every second (or -i ms.)  Only the
+ * shared segment is read, the watched process does no work for it.
+ *
+ *	mwtop [-1] [-i interval] pid
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <mem_shm.h>
+
+static	int shm_copy(const struct mem_shm *,struct mem_shm *);
+static	void show(const struct mem_shm *);
+static	void usage(void);
+
+int
+main(argc, argv)
+	int	argc;
+	char	**argv;
+{
+	struct mem_shm *sh, cp;
+	char name[64];
+	int ch, fd, once, ival;
+
+	once = 0;
+	ival = 1000;
+	while ((ch = getopt(argc, argv, "1i:")) != -1) {
+		switch (ch) {
+		case '1':
+			once = 1;
+			break;
+		case 'i':
+			if ((ival = atoi(optarg)) <= 0)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1)
+		usage();
+
+	snprintf(name, sizeof(name), MEM_SHM_NAME, atoi(argv[optind]));
+	if ((fd = shm_open(name, O_RDONLY, 0)) < 0) {
+		fprintf(stderr, "mwtop: %s: no such segment, did the process "
+		    "call mem_shm_export()?\n", name);
+		return (1);
+	}
+	sh = mmap(NULL, sizeof(*sh), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (sh == MAP_FAILED) {
+		perror("mwtop: mmap");
+		return (1);
+	}
+	if (sh->sh_magic != MEM_SHM_MAGIC ||
+	    sh->sh_version != MEM_SHM_VERSION) {
+		fprintf(stderr, "mwtop: %s: unknown layout\n", name);
+		return (1);
+	}
+
+	for (;;) {
+		if (shm_copy(sh, &cp) < 0) {
+			fprintf(stderr, "mwtop: segment not updated\n");
+			return (1);
+		}
+		if (!once)
+			printf("\033[H\033[J");
+		show(&cp);
+		if (once)
+			break;
+		fflush(stdout);
+		usleep(ival * 1000);
+	}
+	return (0);
+}
+
+/*
+ * Take a consistent copy of the segment, returns -1 if the writer
+ * seems to be stuck in the middle of an update.
+ */
+static int
+shm_copy(sh, cp)
+	const	struct mem_shm *sh;
+	struct	mem_shm *cp;
+{
+	unsigned int seq;
+	int try;
+
+	for (try = 0; try < 1000; try++) {
+		if (((seq = sh->sh_seq) & 1) != 0) {
+			usleep(100);
+			continue;
+		}
+		__sync_synchronize();
+		memcpy(cp, (const void *)sh, sizeof(*cp));
+		__sync_synchronize();
+		if (sh->sh_seq == seq)
+			return (0);
+	}
+	return (-1);
+}
+
+static void
+show(sh)
+	const	struct mem_shm *sh;
+{
+	const struct mem_shm_site *ss;
+	int i;
+
+	printf("pid %d  up %.1fs  updates %lu  snapshots %d\n",
+	    sh->sh_pid, sh->sh_uptime, sh->sh_updates, sh->sh_nsnap);
+	printf("live: %lu bytes in %lu blocks, %d sites\n",
+	    sh->sh_lbytes, sh->sh_lcount, sh->sh_nsites);
+	printf("pool: %d of %d records (peak %d, failed %d), "
+	    "%lu of %lu bytes committed\n\n", sh->sh_nalloc, sh->sh_nobjs,
+	    sh->sh_napeek, sh->sh_afail, sh->sh_committed, sh->sh_reserved);
+	printf("%12s %10s %12s  %s\n", "BYTES", "BLOCKS", "ALLOCS/S",
+	    "SITE");
+	for (i = 0; i < sh->sh_ntop && i < MEM_SHM_TOP; i++) {
+		ss = &sh->sh_top[i];
+		printf("%12lu %10lu %12.1f  %s:%d\n", ss->ss_bytes,
+		    ss->ss_count, ss->ss_rate, ss->ss_file, ss->ss_line);
+	}
+	return;
+}
+
+static void
+usage()
+{
+
+	fprintf(stderr, "usage: mwtop [-1] [-i interval] pid\n");
+	exit(1);
+}